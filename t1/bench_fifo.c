@@ -0,0 +1,564 @@
+#define _POSIX_C_SOURCE 200809L
+#include "fifo.h"
+#include "sfifo.h"
+#include "pfifo.h"
+#include "shmfifo.h"
+#include "sem.h"
+#include "node.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_THREADS    64
+#define MAX_VALUES     16
+#define MAX_BATCH      1024
+#define MESSAGES       20000
+#define RUNS           3
+// Latency samples kept per consumer and run
+#define SAMPLES        (1 << 16)
+
+#ifdef SEM_FUTEX
+#define SEM_NAME "futex"
+#else
+#define SEM_NAME "pthread"
+#endif
+
+// Every implementation moves pointers. A message is its push time in ns, so the
+// consumer knows its latency. 0 tells a competing consumer to stop.
+typedef struct {
+	const char * name;
+	bool broadcast;                 // Every consumer gets every message
+	uint32_t max_producers;         // 0 for any number
+	void (*init)(uint32_t length, uint32_t producers, uint32_t consumers);
+	// Pushes n messages, natively as a batch if the implementation can
+	void (*push)(uint32_t producer, void * const * msgs, uint32_t n);
+	// Pops from 1 to max messages
+	uint32_t (*pop)(uint32_t consumer, void ** msgs, uint32_t max);
+	void (*destroy)(void);
+} impl_t;
+
+// Where threads run and FIFO memory goes
+typedef enum {
+	PLACE_NONE,                     // Left to the scheduler and first touch
+	PLACE_LOCAL,                    // Everything on node 0
+	PLACE_CROSS,                    // Producers on node 0, consumers on the last node
+	PLACEMENTS
+} placement_t;
+
+const char * const placement_names[PLACEMENTS] = { "none", "local", "cross" };
+
+// One point of the sweep
+typedef struct {
+	uint32_t producers;
+	uint32_t consumers;
+	uint32_t length;
+	uint32_t batch;
+	placement_t placement;
+} config_t;
+
+typedef struct {
+	double rate;                    // Messages pushed per second
+	uint64_t p50, p99, p999;        // Latency percentiles (ns)
+} result_t;
+
+typedef struct {
+	uint32_t values[MAX_VALUES];
+	uint32_t count;
+} list_t;
+
+pthread_t threads[2 * MAX_THREADS];
+pthread_attr_t attr;
+uint32_t id[MAX_THREADS];
+const impl_t * impl;
+config_t config;
+uint32_t messages;              // Per producer
+uint64_t * samples[MAX_THREADS];
+uint32_t sample_count[MAX_THREADS];
+
+fifo_t fifo;
+sfifo_t sfifo;
+pfifo_t pfifo;
+shmfifo_t shmfifo;
+char shm_name[64];
+
+// Bounded buffer on semaphores, each message goes to one consumer
+struct {
+	semaphore_t items;
+	semaphore_t space;
+	semaphore_t lock;
+	void ** ring;
+	uint32_t length;
+	uint32_t head;
+	uint32_t tail;
+} semq;
+
+static uint64_t now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int producer_node(void) {
+	return 0;
+}
+
+static int consumer_node(void) {
+	return config.placement == PLACE_CROSS ? node_count() - 1 : 0;
+}
+
+// FIFO options with the placement of the sweep point
+static fifo_config_t fifo_config(uint32_t length, uint32_t consumers) {
+	static int nodes[MAX_THREADS];
+	fifo_config_t c = { .length = length, .consumers = consumers };
+	if (config.placement != PLACE_NONE) {
+		for (uint32_t i=0; i<consumers; i++)
+			nodes[i] = consumer_node();
+		c.numa = true;
+		c.producer_node = producer_node();
+		c.consumer_nodes = nodes;
+	}
+	return c;
+}
+
+static void fifo_setup(uint32_t length, uint32_t producers, uint32_t consumers) {
+	fifo_config_t c = fifo_config(length, consumers);
+	fifo_init_config(&fifo, &c);
+}
+
+static void fifo_sp_setup(uint32_t length, uint32_t producers, uint32_t consumers) {
+	fifo_config_t c = fifo_config(length, consumers);
+	c.single_producer = true;
+	fifo_init_config(&fifo, &c);
+}
+
+static void fifo_records_setup(uint32_t length, uint32_t producers, uint32_t consumers) {
+	fifo_config_t c = fifo_config(length, consumers);
+	c.record_size = sizeof(void *);
+	fifo_init_config(&fifo, &c);
+}
+
+static void fifo_group_setup(uint32_t length, uint32_t producers, uint32_t consumers) {
+	fifo_config_t c = fifo_config(length, 1);
+	fifo_init_config(&fifo, &c);
+	fifo_set_group(&fifo, 0);
+}
+
+static void fifo_push_batch(uint32_t producer, void * const * msgs, uint32_t n) {
+	if (n == 1)
+		fifo_push(&fifo, msgs[0]);
+	else
+		fifo_push_n(&fifo, msgs, n);
+}
+
+static uint32_t fifo_pop_batch(uint32_t consumer, void ** msgs, uint32_t max) {
+	if (max > 1)
+		return fifo_pop_n(&fifo, consumer, msgs, max);
+	fifo_pop(&fifo, consumer, msgs);
+	return 1;
+}
+
+static uint32_t fifo_group_pop(uint32_t consumer, void ** msgs, uint32_t max) {
+	return fifo_pop_batch(0, msgs, max);
+}
+
+static void fifo_records_push(uint32_t producer, void * const * msgs, uint32_t n) {
+	for (uint32_t i=0; i<n; i++) {
+		fifo_seq_t seq;
+		*(void **)fifo_claim(&fifo, &seq) = msgs[i];
+		fifo_publish(&fifo, seq);
+	}
+}
+
+static uint32_t fifo_records_pop(uint32_t consumer, void ** msgs, uint32_t max) {
+	msgs[0] = *(void * const *)fifo_read(&fifo, consumer);
+	fifo_release(&fifo, consumer);
+	return 1;
+}
+
+static void fifo_teardown(void) {
+	fifo_destroy(&fifo);
+}
+
+static void sfifo_setup(uint32_t length, uint32_t producers, uint32_t consumers) {
+	sfifo_init(&sfifo, length, consumers, producers, producers);
+}
+
+static void sfifo_push_batch(uint32_t producer, void * const * msgs, uint32_t n) {
+	for (uint32_t i=0; i<n; i++)
+		sfifo_push(&sfifo, producer, msgs[i]);
+}
+
+static uint32_t sfifo_pop_batch(uint32_t consumer, void ** msgs, uint32_t max) {
+	sfifo_pop(&sfifo, consumer, msgs);
+	return 1;
+}
+
+static void sfifo_teardown(void) {
+	sfifo_destroy(&sfifo);
+}
+
+// Producers alternate between two lanes of the same length
+static void pfifo_setup(uint32_t length, uint32_t producers, uint32_t consumers) {
+	uint32_t lengths[] = {length, length};
+	pfifo_init(&pfifo, 2, lengths, consumers);
+}
+
+static void pfifo_push_batch(uint32_t producer, void * const * msgs, uint32_t n) {
+	for (uint32_t i=0; i<n; i++)
+		pfifo_push(&pfifo, producer % 2, msgs[i]);
+}
+
+static uint32_t pfifo_pop_batch(uint32_t consumer, void ** msgs, uint32_t max) {
+	pfifo_pop(&pfifo, consumer, msgs);
+	return 1;
+}
+
+static void pfifo_teardown(void) {
+	pfifo_destroy(&pfifo);
+}
+
+// Threads of this process share one mapping
+static void shmfifo_setup(uint32_t length, uint32_t producers, uint32_t consumers) {
+	if (shmfifo_create(&shmfifo, shm_name, length, consumers, sizeof(void *)) < 0) {
+		perror("shmfifo_create");
+		exit(1);
+	}
+}
+
+static void shmfifo_push(uint32_t producer, void * const * msgs, uint32_t n) {
+	for (uint32_t i=0; i<n; i++) {
+		uint64_t seq;
+		*(void **)shmfifo_claim(&shmfifo, &seq) = msgs[i];
+		shmfifo_publish(&shmfifo, seq);
+	}
+}
+
+static uint32_t shmfifo_pop(uint32_t consumer, void ** msgs, uint32_t max) {
+	msgs[0] = *(void * const *)shmfifo_read(&shmfifo, consumer);
+	shmfifo_release(&shmfifo, consumer);
+	return 1;
+}
+
+static void shmfifo_teardown(void) {
+	shmfifo_close(&shmfifo);
+	shmfifo_unlink(shm_name);
+}
+
+static void semq_setup(uint32_t length, uint32_t producers, uint32_t consumers) {
+	sem_create(&semq.items, 0);
+	sem_create(&semq.space, length);
+	sem_create(&semq.lock, 1);
+	semq.ring = (void **)malloc(length * sizeof(void *));
+	semq.length = length;
+	semq.head = 0;
+	semq.tail = 0;
+}
+
+static void semq_push(uint32_t producer, void * const * msgs, uint32_t n) {
+	for (uint32_t i=0; i<n; i++) {
+		sem_wait(&semq.space);
+		sem_wait(&semq.lock);
+		semq.ring[semq.head++ % semq.length] = msgs[i];
+		sem_signal(&semq.lock);
+		sem_signal(&semq.items);
+	}
+}
+
+static uint32_t semq_pop(uint32_t consumer, void ** msgs, uint32_t max) {
+	sem_wait(&semq.items);
+	sem_wait(&semq.lock);
+	msgs[0] = semq.ring[semq.tail++ % semq.length];
+	sem_signal(&semq.lock);
+	sem_signal(&semq.space);
+	return 1;
+}
+
+static void semq_teardown(void) {
+	sem_destroy(&semq.items);
+	sem_destroy(&semq.space);
+	sem_destroy(&semq.lock);
+	free(semq.ring);
+}
+
+const impl_t impls[] = {
+	{ "fifo",         true,  0, fifo_setup,         fifo_push_batch,   fifo_pop_batch,
+	  fifo_teardown },
+	{ "fifo_sp",      true,  1, fifo_sp_setup,      fifo_push_batch,   fifo_pop_batch,
+	  fifo_teardown },
+	{ "fifo_records", true,  0, fifo_records_setup, fifo_records_push, fifo_records_pop,
+	  fifo_teardown },
+	{ "fifo_group",   false, 0, fifo_group_setup,   fifo_push_batch,   fifo_group_pop,
+	  fifo_teardown },
+	{ "sfifo",        true,  0, sfifo_setup,        sfifo_push_batch,  sfifo_pop_batch,
+	  sfifo_teardown },
+	{ "pfifo",        true,  0, pfifo_setup,        pfifo_push_batch,  pfifo_pop_batch,
+	  pfifo_teardown },
+	{ "shmfifo",      true,  0, shmfifo_setup,      shmfifo_push,      shmfifo_pop,
+	  shmfifo_teardown },
+	{ "sem",          false, 0, semq_setup,         semq_push,         semq_pop,
+	  semq_teardown },
+};
+#define IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+// Pushes messages stamped with the time, config.batch at a time
+void * producer(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	void * msgs[MAX_BATCH];
+	if (config.placement != PLACE_NONE)
+		node_bind_thread(producer_node());
+	for (uint32_t sent=0; sent < messages; ) {
+		uint32_t n = messages - sent < config.batch ? messages - sent : config.batch;
+		for (uint32_t i=0; i<n; i++)
+			msgs[i] = (void *)(uintptr_t)now_ns();
+		impl->push(id, msgs, n);
+		sent += n;
+	}
+	return NULL;
+}
+
+// Pops every message (broadcast), or until a stop message (competing consumers).
+// A competing consumer passes on the stop messages it popped after its own.
+void * consumer(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	uint64_t expected = (uint64_t)messages * config.producers;
+	uint64_t stride = expected / SAMPLES + 1;
+	uint64_t received = 0;
+	void * msgs[MAX_BATCH];
+	sample_count[id] = 0;
+	if (config.placement != PLACE_NONE)
+		node_bind_thread(consumer_node());
+
+	while (!impl->broadcast || received < expected) {
+		uint32_t n = impl->pop(id, msgs, config.batch);
+		uint64_t t = now_ns();
+		for (uint32_t i=0; i<n; i++) {
+			uint64_t stamp = (uint64_t)(uintptr_t)msgs[i];
+			if (!stamp) {
+				if (n - i > 1)
+					impl->push(0, &msgs[i + 1], n - i - 1);
+				return NULL;
+			}
+			if (received++ % stride == 0 && sample_count[id] < SAMPLES)
+				samples[id][sample_count[id]++] = t - stamp;
+		}
+	}
+	return NULL;
+}
+
+static int compare(const void * a, const void * b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t * sorted, uint32_t count, double p) {
+	return count ? sorted[(uint32_t)(p * (count - 1))] : 0;
+}
+
+static result_t run(void) {
+	impl->init(config.length, config.producers, config.consumers);
+
+	uint64_t start = now_ns();
+	for (uint32_t i=0; i<config.consumers; i++)
+		pthread_create(&threads[i], &attr, consumer, &id[i]);
+	for (uint32_t i=0; i<config.producers; i++)
+		pthread_create(&threads[MAX_THREADS + i], &attr, producer, &id[i]);
+
+	for (uint32_t i=0; i<config.producers; i++)
+		pthread_join(threads[MAX_THREADS + i], NULL);
+	if (!impl->broadcast) {
+		void * stop[MAX_THREADS] = {NULL};
+		impl->push(0, stop, config.consumers);
+	}
+	for (uint32_t i=0; i<config.consumers; i++)
+		pthread_join(threads[i], NULL);
+	double elapsed = (now_ns() - start) * 1e-9;
+
+	impl->destroy();
+
+	uint32_t count = 0;
+	for (uint32_t i=0; i<config.consumers; i++)
+		count += sample_count[i];
+	uint64_t * all = (uint64_t *)malloc((count + 1) * sizeof(uint64_t));
+	count = 0;
+	for (uint32_t i=0; i<config.consumers; i++) {
+		memcpy(&all[count], samples[i], sample_count[i] * sizeof(uint64_t));
+		count += sample_count[i];
+	}
+	qsort(all, count, sizeof(uint64_t), compare);
+
+	result_t r;
+	r.rate = (double)messages * config.producers / elapsed;
+	r.p50 = percentile(all, count, 0.50);
+	r.p99 = percentile(all, count, 0.99);
+	r.p999 = percentile(all, count, 0.999);
+	free(all);
+	return r;
+}
+
+static int compare_results(const void * a, const void * b) {
+	double x = ((const result_t *)a)->rate, y = ((const result_t *)b)->rate;
+	return x < y ? -1 : x > y;
+}
+
+// Parses a comma separated list of numbers from 1 to max
+static bool parse_list(const char * s, list_t * list, uint32_t max) {
+	list->count = 0;
+	while (*s) {
+		char * end;
+		unsigned long v = strtoul(s, &end, 10);
+		if (end == s || v < 1 || v > max || list->count == MAX_VALUES)
+			return false;
+		list->values[list->count++] = v;
+		s = *end == ',' ? end + 1 : end;
+		if (*end && *end != ',')
+			return false;
+	}
+	return list->count > 0;
+}
+
+// Parses a comma separated list of placement names
+static bool parse_placements(const char * s, list_t * list) {
+	list->count = 0;
+	while (*s) {
+		size_t len = strcspn(s, ",");
+		uint32_t p = 0;
+		while (p < PLACEMENTS && (strlen(placement_names[p]) != len
+		                          || strncmp(s, placement_names[p], len)))
+			p++;
+		if (p == PLACEMENTS || list->count == MAX_VALUES)
+			return false;
+		list->values[list->count++] = p;
+		s += s[len] ? len + 1 : len;
+	}
+	return list->count > 0;
+}
+
+static bool selected(const char * names, const char * name) {
+	if (!names)
+		return true;
+	size_t len = strlen(name);
+	for (const char * s = names; (s = strstr(s, name)); s += len) {
+		if ((s == names || s[-1] == ',') && (s[len] == ',' || !s[len]))
+			return true;
+	}
+	return false;
+}
+
+static void usage(const char * prog) {
+	printf("Usage: %s [-p producers] [-c consumers] [-l lengths] [-b batches]\n"
+	       "          [-n placements] [-i implementations] [-m messages] [-r runs]\n"
+	       "          [-o file.csv]\n"
+	       "Lists are comma separated, e.g. -p 1,2,4\n"
+	       "Messages are per run, split between the producers (default %u)\n"
+	       "Placements (default none): none, local (threads and FIFO memory on node 0),\n"
+	       "cross (producers and buffers on node 0, consumers and their cursors on the\n"
+	       "last node, %d here). Only the fifo implementations place memory.\n"
+	       "Implementations:", prog, MESSAGES, node_count() - 1);
+	for (size_t i=0; i<IMPLS; i++)
+		printf(" %s", impls[i].name);
+	printf("\n");
+}
+
+int main(int argc, char ** argv) {
+	list_t producers = { {1, 2, 4}, 3 };
+	list_t consumers = { {1, 2, 4}, 3 };
+	list_t lengths = { {16, 1024}, 2 };
+	list_t batches = { {1, 16}, 2 };
+	list_t places = { {PLACE_NONE}, 1 };
+	const char * names = NULL;
+	const char * csv_name = "bench_fifo.csv";
+	uint32_t total = MESSAGES;
+	uint32_t runs = RUNS;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:c:l:b:n:i:m:r:o:h")) != -1) {
+		bool ok = true;
+		switch (opt) {
+		case 'p': ok = parse_list(optarg, &producers, MAX_THREADS); break;
+		case 'c': ok = parse_list(optarg, &consumers, MAX_THREADS); break;
+		case 'l': ok = parse_list(optarg, &lengths, UINT32_MAX); break;
+		case 'b': ok = parse_list(optarg, &batches, MAX_BATCH); break;
+		case 'n': ok = parse_placements(optarg, &places); break;
+		case 'i': names = optarg; break;
+		case 'm': ok = (total = strtoul(optarg, NULL, 10)) > 0; break;
+		case 'r': ok = (runs = strtoul(optarg, NULL, 10)) > 0; break;
+		case 'o': csv_name = optarg; break;
+		default: ok = false;
+		}
+		if (!ok) {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	FILE * csv = fopen(csv_name, "w");
+	if (!csv) {
+		perror(csv_name);
+		return 1;
+	}
+	fprintf(csv, "impl,sem,producers,consumers,length,batch,placement,run,messages,"
+	             "msgs_per_s,p50_ns,p99_ns,p999_ns\n");
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+	for (int i=0; i<MAX_THREADS; i++) {
+		id[i] = i;
+		samples[i] = (uint64_t *)malloc(SAMPLES * sizeof(uint64_t));
+	}
+	snprintf(shm_name, sizeof(shm_name), "/bench_fifo_%d", (int)getpid());
+
+	printf("%-12s %4s %4s %6s %5s %5s %12s %10s %10s %10s\n", "impl", "prod", "cons",
+	       "length", "batch", "place", "msg/s", "p50 ns", "p99 ns", "p999 ns");
+	result_t * results = (result_t *)malloc(runs * sizeof(result_t));
+	for (size_t k=0; k<IMPLS; k++) {
+		impl = &impls[k];
+		if (!selected(names, impl->name))
+			continue;
+		for (uint32_t p=0; p<producers.count; p++)
+		for (uint32_t c=0; c<consumers.count; c++)
+		for (uint32_t l=0; l<lengths.count; l++)
+		for (uint32_t b=0; b<batches.count; b++)
+		for (uint32_t n=0; n<places.count; n++) {
+			config.producers = producers.values[p];
+			config.consumers = consumers.values[c];
+			config.length = lengths.values[l];
+			config.batch = batches.values[b];
+			config.placement = places.values[n];
+			if (impl->max_producers && config.producers > impl->max_producers)
+				continue;
+			messages = total / config.producers;
+
+			for (uint32_t r=0; r<runs; r++) {
+				results[r] = run();
+				fprintf(csv, "%s,%s,%u,%u,%u,%u,%s,%u,%llu,%.0f,%llu,%llu,%llu\n",
+				        impl->name, SEM_NAME, config.producers, config.consumers,
+				        config.length, config.batch,
+				        placement_names[config.placement], r,
+				        (unsigned long long)messages * config.producers, results[r].rate,
+				        (unsigned long long)results[r].p50,
+				        (unsigned long long)results[r].p99,
+				        (unsigned long long)results[r].p999);
+				fflush(csv);
+			}
+
+			// The median run by throughput
+			qsort(results, runs, sizeof(result_t), compare_results);
+			result_t * m = &results[runs / 2];
+			printf("%-12s %4u %4u %6u %5u %5s %12.0f %10llu %10llu %10llu\n",
+			       impl->name, config.producers, config.consumers, config.length,
+			       config.batch, placement_names[config.placement], m->rate,
+			       (unsigned long long)m->p50, (unsigned long long)m->p99,
+			       (unsigned long long)m->p999);
+			fflush(stdout);
+		}
+	}
+
+	free(results);
+	for (int i=0; i<MAX_THREADS; i++)
+		free(samples[i]);
+	fclose(csv);
+	pthread_attr_destroy(&attr);
+	return 0;
+}
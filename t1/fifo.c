@@ -1,62 +1,1384 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include "fifo.h"
+#include "node.h"
+
+// FIFO_WAIT_HYBRID: time spent spinning and then yielding before parking
+#define FIFO_HYBRID_SPIN_NS  5000
+#define FIFO_HYBRID_YIELD_NS 50000
+// Polls between clock reads while spinning
+#define FIFO_CLOCK_POLLS 64
+
+static inline uint64_t now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static inline uint64_t to_ns(const struct timespec * t) {
+	return t ? (uint64_t)t->tv_sec * 1000000000 + t->tv_nsec : UINT64_MAX;
+}
+
+void fifo_wait_init(fifo_wait_t * w) {
+	pthread_mutex_init(&w->mutex, NULL);
+
+	// Deadlines are CLOCK_MONOTONIC
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&w->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	atomic_init(&w->waiters, 0);
+}
+
+void fifo_wait_destroy(fifo_wait_t * w) {
+	pthread_mutex_destroy(&w->mutex);
+	pthread_cond_destroy(&w->cond);
+}
+
+// Wakes w if there is a waiter. A seq_cst fence must separate the state change
+// the waiters are interested in from this call.
+static void wake_waiters(fifo_wait_t * w) {
+	if (!atomic_load_explicit(&w->waiters, memory_order_relaxed))
+		return;
+
+	pthread_mutex_lock(&w->mutex);
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+void fifo_wait_wake(fifo_wait_t * w) {
+	atomic_thread_fence(memory_order_seq_cst);
+	wake_waiters(w);
+}
+
+bool fifo_wait_until(fifo_wait_t * w, uint32_t spins, spin_ready_fn_t ready, void * arg,
+                     const struct timespec * deadline) {
+	if (spin_until(ready, arg, spins))
+		return true;
+
+	bool ok;
+	pthread_mutex_lock(&w->mutex);
+	atomic_fetch_add(&w->waiters, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	while (!(ok = ready(arg))) {
+		if (!deadline)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		else if (pthread_cond_timedwait(&w->cond, &w->mutex, deadline) == ETIMEDOUT) {
+			ok = ready(arg);
+			break;
+		}
+	}
+	atomic_fetch_sub(&w->waiters, 1);
+	pthread_mutex_unlock(&w->mutex);
+	return ok;
+}
+
+// Ring holding seq. Sequences before the start of the current ring are in older
+// ones, that consumers finish after a resize.
+static inline fifo_ring_t * ring_of(fifo_t * fifo, fifo_seq_t seq) {
+	fifo_ring_t * r = atomic_load_explicit(&fifo->ring, memory_order_acquire);
+	fifo_seq_t start;
+	while (seq < (start = atomic_load_explicit(&r->start, memory_order_acquire))) {
+		// fifo_resize is about to tell where the new ring starts
+		if (start == FIFO_RESIZING)
+			sched_yield();
+		else
+			r = r->prev;
+	}
+	return r;
+}
+
+static inline fifo_slot_t * slot(fifo_t * fifo, fifo_seq_t seq) {
+	fifo_ring_t * r = ring_of(fifo, seq);
+	return &r->buffer[seq % r->length];
+}
+
+// The pointer at seq. Relaxed: readers that may race with a producer check seq after.
+static inline void * slot_data(fifo_t * fifo, fifo_seq_t seq) {
+	return atomic_load_explicit(&slot(fifo, seq)->data, memory_order_relaxed);
+}
+
+static inline fifo_cursor_t * cursor(fifo_t * fifo, uint32_t consumer) {
+	return (fifo_cursor_t *)((uint8_t *)fifo->cursors + consumer * fifo->cursor_stride);
+}
+
+static inline fifo_wait_t * pop_waiters(fifo_t * fifo, fifo_seq_t seq) {
+	return &fifo->wait_pop[seq % FIFO_WAIT_BUCKETS];
+}
+
+static inline bool is_published(fifo_t * fifo, fifo_seq_t seq) {
+	return atomic_load_explicit(&slot(fifo, seq)->seq, memory_order_acquire) == seq + 1;
+}
+
+// True once seq was published, even if the position already holds a later sequence.
+// That happens in overwrite mode when the consumer was lapped, and in a group when
+// other members took seq. Otherwise it is the same as is_published.
+static inline bool is_readable(fifo_t * fifo, fifo_seq_t seq) {
+	fifo_seq_t s = atomic_load_explicit(&slot(fifo, seq)->seq, memory_order_acquire);
+	return s > seq && s != FIFO_WRITING;
+}
+
+// Detached consumers have huge read sequences, so they are never the slowest
+static fifo_seq_t slowest_read(fifo_t * fifo) {
+	fifo_seq_t min;
+	uint32_t epoch;
+	do {
+		// Retry if a consumer attached meanwhile: the others may have moved past
+		// its starting sequence after we read it as detached
+		while ((epoch = atomic_load(&fifo->attach_epoch)) & 1)
+			spin_relax();
+
+		min = atomic_load_explicit(&fifo->write, memory_order_relaxed);
+		for (uint32_t i=0; i<fifo->consumers; i++) {
+			// With a pool, consumers still use the payloads from their last pop
+			fifo_cursor_t * c = cursor(fifo, i);
+			fifo_seq_t r = atomic_load(fifo->pool ? &c->held : &c->read);
+			if (r < min)
+				min = r;
+		}
+	} while (atomic_load(&fifo->attach_epoch) != epoch);
+	return min;
+}
+
+// True if every consumer already read the sequence that used seq's position
+// In overwrite mode, only the producer of the sequence that used the position
+// before must be done with it.
+// Updates the cached tail from the consumers, tail being the value read before.
+// Returns the slowest read sequence.
+static fifo_seq_t refresh_tail(fifo_t * fifo, fifo_seq_t tail) {
+	fifo_seq_t min = slowest_read(fifo);
+	if (fifo->single_producer) {
+		// The producer is the only one moving tail forward, so no read-modify-write.
+		// A consumer checking for space (space_freed) may store an older min, which
+		// is still behind every consumer: tail only has to be a lower bound.
+		if (tail < min)
+			atomic_store_explicit(&fifo->tail, min, memory_order_release);
+		return min;
+	}
+	while (tail < min && !atomic_compare_exchange_weak(&fifo->tail, &tail, min));
+	return min;
+}
+
+// Positions of a ring before its start + length were never used, so they are free
+// even while consumers still read an older ring.
+static bool has_space(fifo_t * fifo, fifo_seq_t seq) {
+	fifo_ring_t * r = ring_of(fifo, seq);
+	if (fifo->overwrite)
+		return seq < r->length || atomic_load_explicit(&r->buffer[seq % r->length].seq,
+		                          memory_order_acquire) == seq - r->length + 1;
+
+	fifo_seq_t start = atomic_load_explicit(&r->start, memory_order_relaxed);
+	fifo_seq_t tail = atomic_load_explicit(&fifo->tail, memory_order_acquire);
+	if (seq < (tail > start ? tail : start) + r->length)
+		return true;
+
+	fifo_seq_t min = refresh_tail(fifo, tail);
+	return seq < (min > start ? min : start) + r->length;
+}
+
+// Moves in and out of congestion while the occupancy is past a watermark. Changes
+// are rare, so they are serialized to keep the callbacks in order. After a change
+// the occupancy is checked again: a consumer (or producer) may have missed the
+// new state while it moved the other way.
+static void update_watermarks(fifo_t * fifo) {
+	pthread_mutex_lock(&fifo->watermark_mutex);
+	for (;;) {
+		fifo_seq_t used = atomic_load(&fifo->write) - slowest_read(fifo);
+		bool congested = atomic_load_explicit(&fifo->congested, memory_order_relaxed);
+		if (congested ? used > fifo->low_watermark : used < fifo->high_watermark)
+			break;
+		atomic_store(&fifo->congested, !congested);
+		if (fifo->watermark_fn)
+			fifo->watermark_fn(fifo->watermark_arg, !congested);
+	}
+	pthread_mutex_unlock(&fifo->watermark_mutex);
+}
+
+// After a push. The cached tail is behind the consumers, so the occupancy it gives
+// is only an upper bound: the consumers are read only near the high watermark.
+static inline void watch_high(fifo_t * fifo) {
+	if (!fifo->high_watermark || atomic_load_explicit(&fifo->congested, memory_order_relaxed))
+		return;
+	fifo_seq_t write = atomic_load_explicit(&fifo->write, memory_order_relaxed);
+	fifo_seq_t tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+	if (write - tail >= fifo->high_watermark
+	    && write - refresh_tail(fifo, tail) >= fifo->high_watermark)
+		update_watermarks(fifo);
+}
+
+// After a pop, with a seq_cst fence since the consumer moved. Only reads the
+// consumers while congested.
+static inline void watch_low(fifo_t * fifo) {
+	if (atomic_load_explicit(&fifo->congested, memory_order_relaxed)
+	    && atomic_load(&fifo->write) - slowest_read(fifo) <= fifo->low_watermark)
+		update_watermarks(fifo);
+}
+
+#ifdef FIFO_STATS
+#define STATS(...) __VA_ARGS__
+
+// Counters of one consumer ID in a thread
+typedef struct {
+	_Atomic uint64_t pop_calls, popped, blocked_pops, wait_ns;
+	_Atomic uint64_t lag[FIFO_STATS_BUCKETS];
+	_Atomic uint64_t latency_ns[FIFO_STATS_BUCKETS];
+} stats_consumer_t;
+
+// Counters of one thread for one FIFO, on their own cache lines. Only that thread
+// writes them and fifo_stats only reads them, so they are updated with relaxed
+// loads and stores instead of read-modify-write operations.
+struct fifo_stats_block {
+	fifo_stats_block_t * next;
+	uint32_t push_sample;           // Pushes until the next occupancy sample
+	uint32_t stamp_sample;          // Publishes until the next stamped one
+	uint32_t pop_sample;            // Pops until the next sampled one
+	_Atomic uint64_t push_calls, pushed, blocked_pushes, push_wait_ns;
+	_Atomic uint64_t occupancy[FIFO_STATS_BUCKETS];
+	stats_consumer_t consumer[];
+};
+
+static inline void add(_Atomic uint64_t * counter, uint64_t n) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+	                      memory_order_relaxed);
+}
+
+static inline void add_bucket(_Atomic uint64_t * histogram, uint64_t value) {
+	uint32_t b = value ? 64 - __builtin_clzll(value) : 0;
+	add(&histogram[b < FIFO_STATS_BUCKETS ? b : FIFO_STATS_BUCKETS - 1], 1);
+}
+
+// True once every FIFO_STATS_SAMPLE calls, starting with the first
+static inline bool sample(uint32_t * countdown) {
+	if ((*countdown)--)
+		return false;
+	*countdown = FIFO_STATS_SAMPLE - 1;
+	return true;
+}
+
+static fifo_stats_block_t * stats_block(fifo_t * fifo) {
+	fifo_stats_block_t * b = (fifo_stats_block_t *)pthread_getspecific(fifo->stats_key);
+	if (b)
+		return b;
+
+	size_t size = sizeof(fifo_stats_block_t) + fifo->consumers * sizeof(stats_consumer_t);
+	size = (size + 63) / 64 * 64;
+	b = (fifo_stats_block_t *)aligned_alloc(64, size);
+	memset(b, 0, size);
+	pthread_mutex_lock(&fifo->stats_mutex);
+	b->next = fifo->stats_blocks;
+	fifo->stats_blocks = b;
+	pthread_mutex_unlock(&fifo->stats_mutex);
+	pthread_setspecific(fifo->stats_key, b);
+	return b;
+}
+
+// A producer waited for space since start, if start isn't 0
+static void stats_push_waited(fifo_t * fifo, uint64_t start) {
+	if (!start)
+		return;
+	fifo_stats_block_t * b = stats_block(fifo);
+	add(&b->blocked_pushes, 1);
+	add(&b->push_wait_ns, now_ns() - start);
+}
+
+static void stats_pop_waited(fifo_t * fifo, uint32_t consumer, uint64_t start) {
+	if (!start)
+		return;
+	stats_consumer_t * c = &stats_block(fifo)->consumer[consumer];
+	add(&c->blocked_pops, 1);
+	add(&c->wait_ns, now_ns() - start);
+}
+
+// A push call added count pointers or records
+static void stats_pushed(fifo_t * fifo, uint32_t count) {
+	fifo_stats_block_t * b = stats_block(fifo);
+	add(&b->push_calls, 1);
+	add(&b->pushed, count);
+	if (count && sample(&b->push_sample)) {
+		fifo_seq_t used = atomic_load_explicit(&fifo->write, memory_order_relaxed)
+		                  - slowest_read(fifo);
+		uint32_t length = fifo_length(fifo);
+		add_bucket(b->occupancy, used < length ? used : length);
+	}
+}
+
+// Stamps a sampled push with its publish time, before it is published
+static void stats_stamp(fifo_t * fifo, fifo_seq_t seq) {
+	fifo_stats_block_t * b = stats_block(fifo);
+	atomic_store_explicit(&slot(fifo, seq)->stamp, sample(&b->stamp_sample) ? now_ns() : 0,
+	                      memory_order_relaxed);
+}
+
+static inline uint64_t slot_stamp(fifo_t * fifo, fifo_seq_t seq) {
+	return atomic_load_explicit(&slot(fifo, seq)->stamp, memory_order_relaxed);
+}
+
+static inline uint64_t load(_Atomic uint64_t * counter) {
+	return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// Adds the counters of c in one thread to total
+static void sum_consumer(fifo_consumer_stats_t * total, stats_consumer_t * c) {
+	total->pop_calls += load(&c->pop_calls);
+	total->popped += load(&c->popped);
+	total->blocked_pops += load(&c->blocked_pops);
+	total->wait_ns += load(&c->wait_ns);
+	for (int i=0; i<FIFO_STATS_BUCKETS; i++) {
+		total->lag[i] += load(&c->lag[i]);
+		total->latency_ns[i] += load(&c->latency_ns[i]);
+	}
+}
+
+// A pop call of consumer got count pointers or records, starting at seq. stamp is
+// the one of seq, read while the position still held it.
+static void stats_popped(fifo_t * fifo, uint32_t consumer, fifo_seq_t seq,
+                         uint64_t stamp, uint32_t count) {
+	fifo_stats_block_t * b = stats_block(fifo);
+	stats_consumer_t * c = &b->consumer[consumer];
+	add(&c->pop_calls, 1);
+	add(&c->popped, count);
+	if (!count)
+		return;
+	if (stamp)
+		add_bucket(c->latency_ns, now_ns() - stamp);
+	if (sample(&b->pop_sample))
+		add_bucket(c->lag, atomic_load_explicit(&fifo->write, memory_order_relaxed) - seq);
+}
+#else
+#define STATS(...)
+#endif
+
+static fifo_ring_t * ring_alloc(fifo_t * fifo, uint32_t length) {
+	fifo_ring_t * r = (fifo_ring_t *)malloc(sizeof(fifo_ring_t));
+	r->records = NULL;
+	if (fifo->node >= 0) {
+		// On the producers' node. Pages are aligned for any record type.
+		r->buffer = (fifo_slot_t *)node_alloc(length * sizeof(fifo_slot_t), fifo->node);
+		if (fifo->record_size)
+			r->records = (uint8_t *)node_alloc(length * fifo->record_size, fifo->node);
+	} else {
+		r->buffer = (fifo_slot_t *)malloc(length * sizeof(fifo_slot_t));
+		// Keep every record aligned for any type
+		if (fifo->record_size)
+			r->records = (uint8_t *)aligned_alloc(_Alignof(max_align_t),
+			                                      length * fifo->record_size);
+	}
+	for (uint32_t i=0; i<length; i++)
+		atomic_init(&r->buffer[i].seq, 0);
+	r->length = length;
+	r->end = FIFO_DETACHED;
+	r->prev = NULL;
+	r->next = NULL;
+	return r;
+}
+
+// Frees the payloads still in a ring
+static void free_payloads(fifo_ring_t * r) {
+	for (uint32_t i=0; i<r->length; i++) {
+		if (atomic_load(&r->buffer[i].seq))
+			pool_free(atomic_load_explicit(&r->buffer[i].data, memory_order_relaxed));
+	}
+}
+
+// Frees the buffers of a ring. The ring itself stays, as threads that look for an
+// unclaimed sequence (has_space) may still walk through it.
+static void release_ring(fifo_t * fifo, fifo_ring_t * r) {
+	if (fifo->pool)
+		free_payloads(r);
+	if (fifo->node >= 0) {
+		node_free(r->buffer, r->length * sizeof(fifo_slot_t));
+		node_free(r->records, r->length * fifo->record_size);
+	} else {
+		free(r->buffer);
+		free(r->records);
+	}
+	r->buffer = NULL;
+	r->records = NULL;
+}
+
+// Releases the old rings every consumer moved past. A consumer that read the first
+// sequence of the next ring never looks at an older one again, so the gate is
+// past end, not at it. Must hold resize_mutex.
+static void release_rings(fifo_t * fifo) {
+	fifo_ring_t * current = atomic_load_explicit(&fifo->ring, memory_order_relaxed);
+	fifo_ring_t * r = fifo->oldest;
+	for (;;) {
+		fifo_seq_t min = slowest_read(fifo);
+		for (; r != current && min > r->end; r = r->next)
+			release_ring(fifo, r);
+		fifo->oldest = r;
+
+		fifo_seq_t end = r != current ? r->end : FIFO_DETACHED;
+		atomic_store(&fifo->reclaim, end);
+		// Consumers that moved past end before they saw it in reclaim won't call
+		// release_old for it
+		if (end == FIFO_DETACHED || slowest_read(fifo) <= end)
+			return;
+	}
+}
+
+static void release_old(fifo_t * fifo) {
+	pthread_mutex_lock(&fifo->resize_mutex);
+	release_rings(fifo);
+	pthread_mutex_unlock(&fifo->resize_mutex);
+}
+
+// Sequences claimed from now on go to a new ring. Must hold resize_mutex.
+static void start_ring(fifo_t * fifo, uint32_t length) {
+	fifo_ring_t * old = atomic_load_explicit(&fifo->ring, memory_order_relaxed);
+	fifo_ring_t * r = ring_alloc(fifo, length);
+	atomic_init(&r->start, FIFO_RESIZING);
+	r->prev = old;
+	old->next = r;
+
+	// Producers claim with acquire, so whoever claims after the read of write below
+	// sees the new ring, and waits until its start is known
+	atomic_store_explicit(&fifo->ring, r, memory_order_release);
+	fifo_seq_t start = atomic_fetch_add_explicit(&fifo->write, 0, memory_order_acq_rel);
+	old->end = start;
+	if (fifo->oldest == old)
+		atomic_store(&fifo->reclaim, start);
+	atomic_store_explicit(&r->start, start, memory_order_release);
+	release_rings(fifo);
+}
+
+// Groups keep stale cursors into a ring after other members moved past it, and
+// overwriting producers never wait for the consumers to leave it
+static bool resizable(fifo_t * fifo) {
+	if (fifo->overwrite)
+		return false;
+	for (uint32_t i=0; i<fifo->consumers; i++) {
+		if (fifo->group[i])
+			return false;
+	}
+	return true;
+}
+
+// Auto growth, when a producer finds the FIFO full: doubles the length, up to
+// max_length. Returns false if it can't grow anymore.
+static bool grow(fifo_t * fifo) {
+	fifo_ring_t * r = atomic_load_explicit(&fifo->ring, memory_order_acquire);
+	if (r->length >= fifo->max_length || !resizable(fifo))
+		return false;
+
+	pthread_mutex_lock(&fifo->resize_mutex);
+	// Another producer may have grown it meanwhile
+	if (atomic_load_explicit(&fifo->ring, memory_order_relaxed) == r) {
+		uint64_t length = 2 * (uint64_t)r->length;
+		start_ring(fifo, length < fifo->max_length ? length : fifo->max_length);
+	}
+	pthread_mutex_unlock(&fifo->resize_mutex);
+	return true;
+}
+
+// Polls ready(fifo, seq) with a pause (or yield) between polls until it is true,
+// until is reached or the deadline (in ns). Returns the last poll result.
+static bool poll_until(bool (*ready)(fifo_t *, fifo_seq_t), fifo_t * fifo, fifo_seq_t seq,
+                       uint64_t until, uint64_t deadline, bool yield) {
+	if (deadline < until)
+		until = deadline;
+	for (uint32_t i=1;; i++) {
+		if (ready(fifo, seq))
+			return true;
+		if (yield)
+			sched_yield();
+		else
+			spin_relax();
+		if (!(i % FIFO_CLOCK_POLLS) && until != UINT64_MAX && now_ns() >= until)
+			return ready(fifo, seq);
+	}
+}
+
+// Condition of wait_for, for spin_until and fifo_wait_until
+typedef struct {
+	bool (*ready)(fifo_t *, fifo_seq_t);
+	fifo_t * fifo;
+	fifo_seq_t seq;
+} fifo_poll_t;
+
+static bool poll_ready(void * p) {
+	fifo_poll_t * poll = (fifo_poll_t *)p;
+	return poll->ready(poll->fifo, poll->seq);
+}
+
+// Waits with the given strategy until ready(fifo, seq) or the deadline (if not NULL),
+// parking on w if the strategy blocks. Returns false on timeout.
+static bool wait_for(fifo_wait_t * w, bool (*ready)(fifo_t *, fifo_seq_t),
+                     fifo_t * fifo, fifo_seq_t seq, const struct timespec * deadline,
+                     fifo_wait_strategy_t strategy) {
+	if (ready(fifo, seq))
+		return true;
+
+	fifo_poll_t poll = { ready, fifo, seq };
+	uint64_t end = to_ns(deadline);
+	switch (strategy) {
+	case FIFO_WAIT_SPIN:
+		return poll_until(ready, fifo, seq, UINT64_MAX, end, false);
+
+	case FIFO_WAIT_YIELD:
+		if (spin_until(poll_ready, &poll, SPIN_POLLS))
+			return true;
+		return poll_until(ready, fifo, seq, UINT64_MAX, end, true);
+
+	case FIFO_WAIT_HYBRID: {
+		uint64_t start = now_ns();
+		if (poll_until(ready, fifo, seq, start + FIFO_HYBRID_SPIN_NS, end, false)
+		    || poll_until(ready, fifo, seq, start + FIFO_HYBRID_YIELD_NS, end, true))
+			return true;
+		if (now_ns() >= end)
+			return false;
+		break;
+	}
+
+	case FIFO_WAIT_BLOCK:
+		break;
+	}
+	return fifo_wait_until(w, 0, poll_ready, &poll, deadline);
+}
+
+static bool wait_published(fifo_t * fifo, uint32_t consumer, fifo_seq_t seq,
+                           const struct timespec * deadline) {
+	STATS(uint64_t start = is_readable(fifo, seq) ? 0 : now_ns();)
+	bool ok = wait_for(pop_waiters(fifo, seq), is_readable, fifo, seq, deadline,
+	                   cursor(fifo, consumer)->wait);
+	STATS(stats_pop_waited(fifo, consumer, start);)
+	return ok;
+}
+
+static bool wait_space(fifo_t * fifo, fifo_seq_t seq, const struct timespec * deadline) {
+	STATS(uint64_t start = has_space(fifo, seq) ? 0 : now_ns();)
+	bool ok;
+	// Nobody wakes overwriting producers, they wait for another producer that is
+	// about to publish
+	if (fifo->overwrite)
+		ok = poll_until(has_space, fifo, seq, UINT64_MAX, to_ns(deadline), true);
+	else
+		ok = wait_for(&fifo->wait_push, has_space, fifo, seq, deadline, fifo->wait);
+	STATS(stats_push_waited(fifo, start);)
+	return ok;
+}
+
+// Claims count sequences for the calling producer. Acquire, so a sequence claimed
+// after a resize is looked up in the new ring (see start_ring).
+static inline fifo_seq_t claim(fifo_t * fifo, uint32_t count) {
+	if (fifo->single_producer) {
+		fifo_seq_t seq = atomic_load_explicit(&fifo->write, memory_order_relaxed);
+		atomic_store_explicit(&fifo->write, seq + count, memory_order_release);
+		return seq;
+	}
+	return atomic_fetch_add_explicit(&fifo->write, count, memory_order_acquire);
+}
+
+// Claims count sequences only once there is space for all of them, so a failed
+// claim leaves no hole in the FIFO. Doesn't block if deadline is NULL and block is
+// false. With max_length, grows the FIFO instead of waiting while it can.
+static bool claim_space(fifo_t * fifo, fifo_seq_t * seq, uint32_t count, bool block,
+                        const struct timespec * deadline) {
+	*seq = atomic_load_explicit(&fifo->write, memory_order_acquire);
+	for (;;) {
+		fifo_seq_t last = *seq + count - 1;
+		if (fifo->max_length && !has_space(fifo, last) && grow(fifo)) {
+			*seq = atomic_load_explicit(&fifo->write, memory_order_acquire);
+			continue;
+		}
+		// Another producer may claim seq meanwhile, then the CAS fails and we retry
+		if (!(block ? wait_space(fifo, last, deadline) : has_space(fifo, last)))
+			return false;
+		if (fifo->single_producer) {
+			atomic_store_explicit(&fifo->write, *seq + count, memory_order_release);
+			return true;
+		}
+		if (atomic_compare_exchange_weak_explicit(&fifo->write, seq, *seq + count,
+		                                          memory_order_acquire,
+		                                          memory_order_acquire))
+			return true;
+	}
+}
+
+static inline void * record(fifo_t * fifo, fifo_seq_t seq) {
+	fifo_ring_t * r = ring_of(fifo, seq);
+	return r->records + (seq % r->length) * fifo->record_size;
+}
+
+static void signal_fd(int fd) {
+	uint64_t one = 1;
+	// Can only fail if the counter would overflow, then it is signaled anyway
+	if (write(fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+// Clears fd_armed. Returns true if it was set, then the caller signals the eventfd
+// or reads the data itself.
+static bool disarm_consumer_fd(fifo_t * fifo, uint32_t consumer) {
+	if (!atomic_exchange(&cursor(fifo, consumer)->fd_armed, false))
+		return false;
+	atomic_fetch_sub(&fifo->armed_fds, 1);
+	return true;
+}
+
+// Wakes the selectors watching any consumer, and signals the eventfds of consumers
+// that found the FIFO empty. Like wake_waiters, must follow a seq_cst fence.
+static void wake_watchers(fifo_t * fifo) {
+	if (atomic_load_explicit(&fifo->selectors, memory_order_relaxed)) {
+		for (uint32_t i=0; i<fifo->consumers; i++) {
+			fifo_wait_t * w = atomic_load_explicit(&fifo->selector[i],
+			                                       memory_order_relaxed);
+			if (w)
+				wake_waiters(w);
+		}
+	}
+
+	// Nobody to signal most of the time
+	if (atomic_load_explicit(&fifo->armed_fds, memory_order_relaxed)) {
+		for (uint32_t i=0; i<fifo->consumers; i++) {
+			if (atomic_load_explicit(&cursor(fifo, i)->fd_armed, memory_order_relaxed)
+			    && disarm_consumer_fd(fifo, i))
+				signal_fd(fifo->consumer_fd[i]);
+		}
+	}
+}
+
+static void mark_published(fifo_t * fifo, fifo_seq_t seq) {
+	STATS(stats_stamp(fifo, seq);)
+	atomic_store_explicit(&slot(fifo, seq)->seq, seq + 1, memory_order_release);
+	fifo_wait_wake(pop_waiters(fifo, seq));
+	wake_watchers(fifo);
+}
+
+static void store(fifo_t * fifo, fifo_seq_t seq, void * p) {
+	fifo_slot_t * s = slot(fifo, seq);
+	// With a pool, every consumer is done with the payload this position had
+	if (fifo->pool && atomic_load_explicit(&s->seq, memory_order_relaxed))
+		pool_free(atomic_load_explicit(&s->data, memory_order_relaxed));
+	// Consumers that were lapped may be reading the position, let them notice
+	if (fifo->overwrite) {
+		atomic_store_explicit(&s->seq, FIFO_WRITING, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+	}
+	atomic_store_explicit(&s->data, p, memory_order_relaxed);
+}
+
+static void publish(fifo_t * fifo, fifo_seq_t seq, void * p) {
+	store(fifo, seq, p);
+	mark_published(fifo, seq);
+}
+
+// Wakes producers after a consumer moved, and signals the space eventfd if a
+// producer found the FIFO full and there is space now
+static void space_freed(fifo_t * fifo) {
+	fifo_wait_wake(&fifo->wait_push);
+	watch_low(fifo);
+	if (fifo->space_fd >= 0
+	    && atomic_load_explicit(&fifo->space_armed, memory_order_relaxed)
+	    && has_space(fifo, atomic_load(&fifo->write))
+	    && atomic_exchange(&fifo->space_armed, false))
+		signal_fd(fifo->space_fd);
+}
+
+// The consumer read [first, next) and, with a pool, still uses those payloads
+static void mark_read(fifo_t * fifo, uint32_t consumer, fifo_seq_t first, fifo_seq_t next) {
+	// Sequence that gates the producers, before and after
+	fifo_seq_t from = first;
+	fifo_seq_t to = next;
+	if (fifo->pool) {
+		from = atomic_load_explicit(&cursor(fifo, consumer)->held, memory_order_relaxed);
+		to = first;
+		atomic_store_explicit(&cursor(fifo, consumer)->held, first, memory_order_release);
+	}
+	atomic_store_explicit(&cursor(fifo, consumer)->read, next, memory_order_release);
+	// Overwriting producers never wait for consumers
+	if (!fifo->overwrite)
+		space_freed(fifo);
+
+	// Moved past the end of the oldest ring, which may be released now. The fence
+	// in space_freed orders this with release_rings.
+	fifo_seq_t end = atomic_load_explicit(&fifo->reclaim, memory_order_relaxed);
+	if (from <= end && end < to)
+		release_old(fifo);
+}
+
+// Before a consumer with an eventfd reports that it found nothing: makes the next
+// push signal the eventfd. Returns true if data arrived meanwhile, then the
+// caller tries again, and the eventfd is left unarmed so it doesn't fire for data
+// the caller takes now.
+static bool arm_consumer_fd(fifo_t * fifo, uint32_t consumer) {
+	if (fifo->consumer_fd[consumer] < 0)
+		return false;
+	if (!atomic_exchange(&cursor(fifo, consumer)->fd_armed, true))
+		atomic_fetch_add(&fifo->armed_fds, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	fifo_seq_t seq = atomic_load_explicit(&cursor(fifo, consumer)->read,
+	                                      memory_order_acquire);
+	if (!is_readable(fifo, seq))
+		return false;
+	disarm_consumer_fd(fifo, consumer);
+	return true;
+}
+
+// Same for a producer that found the FIFO full
+static bool arm_space_fd(fifo_t * fifo) {
+	if (fifo->space_fd < 0)
+		return false;
+	atomic_store(&fifo->space_armed, true);
+	atomic_thread_fence(memory_order_seq_cst);
+	return has_space(fifo, atomic_load(&fifo->write));
+}
+
+// Copies the pointer at seq unless a producer replaced it (seqlock style read)
+static bool read_slot(fifo_t * fifo, fifo_seq_t seq, void ** out) {
+	fifo_slot_t * s = slot(fifo, seq);
+	if (atomic_load_explicit(&s->seq, memory_order_acquire) != seq + 1)
+		return false;
+	*out = atomic_load_explicit(&s->data, memory_order_relaxed);
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&s->seq, memory_order_relaxed) == seq + 1;
+}
+
+// Overwrite mode: reads a readable seq, skipping to the oldest sequence left
+// while the consumer is lapped. The oldest sequence was already claimed, so
+// waiting for it only waits for its producer to publish. Returns the sequence read.
+static fifo_seq_t read_lossy(fifo_t * fifo, uint32_t consumer, fifo_seq_t seq,
+                             void ** out) {
+	fifo_seq_t first = seq;
+	while (!read_slot(fifo, seq, out)) {
+		seq = atomic_load(&fifo->write) - fifo_length(fifo);
+		wait_published(fifo, consumer, seq, NULL);
+	}
+	if (seq != first)
+		atomic_fetch_add_explicit(&cursor(fifo, consumer)->lost, seq - first,
+		                          memory_order_relaxed);
+	return seq;
+}
+
+// Returns the number of pointers skipped
+static fifo_seq_t consume(fifo_t * fifo, uint32_t consumer, fifo_seq_t seq,
+                          void ** out) {
+	fifo_seq_t first = seq;
+	if (fifo->overwrite)
+		seq = read_lossy(fifo, consumer, seq, out);
+	else
+		*out = slot_data(fifo, seq);
+	STATS(stats_popped(fifo, consumer, seq, slot_stamp(fifo, seq), 1);)
+	mark_read(fifo, consumer, seq, seq + 1);
+	return seq - first;
+}
+
+// Members of a group compete for its cursor: each copies up to max pointers and
+// then moves the cursor past them. If the CAS fails, other members took them,
+// so it retries from the new cursor. Returns how many were copied, 0 on timeout
+// or if there are none and block is false.
+static uint32_t pop_group(fifo_t * fifo, uint32_t consumer, void ** out, uint32_t max,
+                          bool block, const struct timespec * deadline) {
+	fifo_seq_t seq = atomic_load_explicit(&cursor(fifo, consumer)->read,
+	                                      memory_order_acquire);
+	for (;;) {
+		if (!(block ? wait_published(fifo, consumer, seq, deadline)
+		            : is_readable(fifo, seq))) {
+			STATS(stats_popped(fifo, consumer, seq, 0, 0);)
+			return 0;
+		}
+
+		// None if seq was taken and its position reused meanwhile
+		uint32_t count = 0;
+		while (count < max && is_published(fifo, seq + count)) {
+			out[count] = slot_data(fifo, seq + count);
+			count++;
+		}
+		// If the position was reused meanwhile the copies are stale, but the CAS fails
+		STATS(uint64_t stamp = count ? slot_stamp(fifo, seq) : 0;)
+
+		if (!count)
+			seq = atomic_load_explicit(&cursor(fifo, consumer)->read, memory_order_acquire);
+		else if (atomic_compare_exchange_weak_explicit(&cursor(fifo, consumer)->read, &seq,
+		                                               seq + count,
+		                                               memory_order_acq_rel,
+		                                               memory_order_acquire)) {
+			STATS(stats_popped(fifo, consumer, seq, stamp, count);)
+			space_freed(fifo);
+			return count;
+		}
+	}
+}
 
 void fifo_init(fifo_t * fifo, uint32_t length, uint32_t consumers) {
-	fifo->buffer = (void **)malloc((length + 1) * sizeof(void*));
-	fifo->read = (uint32_t *)calloc(consumers, sizeof(uint32_t));
-	fifo->sem_pop = (semaphore_t *)malloc((length + 1) * sizeof(semaphore_t));
-	for (uint32_t i=0; i<length + 1; i++)
-		sem_create(&fifo->sem_pop[i], 0);
-	fifo->write = 0;
-	fifo->length = length + 1;
-	fifo->consumers = consumers;
-	sem_create(&fifo->sem_push, length);
-	pthread_mutex_init(&fifo->mutex, NULL);
+	fifo_config_t config = { .length = length, .consumers = consumers };
+	fifo_init_config(fifo, &config);
 }
 
-void fifo_clear(fifo_t * fifo) {
-	pthread_mutex_lock(&fifo->mutex);
-	fifo->write = 0;
-	
+void fifo_init_records(fifo_t * fifo, uint32_t length, uint32_t consumers,
+                       size_t record_size) {
+	fifo_config_t config = { .length = length, .consumers = consumers,
+	                         .record_size = record_size };
+	fifo_init_config(fifo, &config);
+}
+
+// Without numa the cursors are an array of cache lines. With it, each one gets a
+// page, the unit of placement, on the node of its consumer.
+static void alloc_cursors(fifo_t * fifo, uint32_t slots, const fifo_config_t * config) {
+	if (fifo->node < 0) {
+		fifo->cursor_stride = sizeof(fifo_cursor_t);
+		fifo->cursors = (fifo_cursor_t *)aligned_alloc(_Alignof(fifo_cursor_t),
+		                                               slots * sizeof(fifo_cursor_t));
+		return;
+	}
+	fifo->cursor_stride = node_page_size();
+	fifo->cursors = (fifo_cursor_t *)node_alloc(slots * fifo->cursor_stride, -1);
+	for (uint32_t i=0; i<slots; i++) {
+		int node = config->consumer_nodes ? config->consumer_nodes[i] : fifo->node;
+		node_place(cursor(fifo, i), fifo->cursor_stride, node);
+	}
+}
+
+void fifo_init_config(fifo_t * fifo, const fifo_config_t * config) {
+	uint32_t length = config->length;
+	uint32_t consumers = config->consumers;
+	size_t record_size = config->record_size;
+
+	fifo->pool = NULL;
+	fifo->node = config->numa ? config->producer_node : -1;
+	size_t align = _Alignof(max_align_t);
+	fifo->record_size = (record_size + align - 1) / align * align;
+	fifo_ring_t * ring = ring_alloc(fifo, length);
+	atomic_init(&ring->start, 0);
+	atomic_init(&fifo->ring, ring);
+	fifo->rings = ring;
+	fifo->oldest = ring;
+	atomic_init(&fifo->reclaim, FIFO_DETACHED);
+	pthread_mutex_init(&fifo->resize_mutex, NULL);
+	fifo->max_length = config->max_length;
+	uint32_t slots = consumers > config->max_consumers ? consumers : config->max_consumers;
+	alloc_cursors(fifo, slots, config);
+	for (uint32_t i=0; i<slots; i++) {
+		fifo_cursor_t * c = cursor(fifo, i);
+		atomic_init(&c->read, i < consumers ? 0 : FIFO_DETACHED);
+		atomic_init(&c->held, 0);
+		atomic_init(&c->lost, 0);
+		atomic_init(&c->fd_armed, false);
+		c->wait = config->wait;
+	}
+	atomic_init(&fifo->attach_epoch, 0);
+	fifo->consumers = consumers = slots;
+	fifo->wait = config->wait;
+	fifo->single_producer = config->single_producer;
+	fifo->overwrite = config->overwrite;
+	fifo->group = (bool *)calloc(consumers, sizeof(bool));
+	fifo->selector = (_Atomic(fifo_wait_t *) *)calloc(consumers, sizeof(fifo_wait_t *));
+	atomic_init(&fifo->selectors, 0);
+	fifo->consumer_fd = (int *)malloc(consumers * sizeof(int));
+	for (uint32_t i=0; i<consumers; i++)
+		fifo->consumer_fd[i] = -1;
+	atomic_init(&fifo->armed_fds, 0);
+	fifo->space_fd = -1;
+	atomic_init(&fifo->space_armed, false);
+	fifo->high_watermark = 0;
+	fifo->low_watermark = 0;
+	fifo->watermark_fn = NULL;
+	fifo->watermark_arg = NULL;
+	atomic_init(&fifo->congested, false);
+	pthread_mutex_init(&fifo->watermark_mutex, NULL);
+	for (int i=0; i<FIFO_WAIT_BUCKETS; i++)
+		fifo_wait_init(&fifo->wait_pop[i]);
+	fifo_wait_init(&fifo->wait_push);
+#ifdef FIFO_STATS
+	pthread_mutex_init(&fifo->stats_mutex, NULL);
+	fifo->stats_blocks = NULL;
+	pthread_key_create(&fifo->stats_key, NULL);
+#endif
+	fifo_clear(fifo);
+}
+
+void fifo_set_consumer_wait(fifo_t * fifo, uint32_t consumer,
+                            fifo_wait_strategy_t strategy) {
+	cursor(fifo, consumer)->wait = strategy;
+}
+
+void fifo_set_group(fifo_t * fifo, uint32_t consumer) {
+	fifo->group[consumer] = true;
+}
+
+int fifo_consumer_fd(fifo_t * fifo, uint32_t consumer) {
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	fifo->consumer_fd[consumer] = fd;
+	// Nothing popped yet: signal right away if there is data
+	if (arm_consumer_fd(fifo, consumer))
+		signal_fd(fd);
+	return fd;
+}
+
+int fifo_space_fd(fifo_t * fifo) {
+	fifo->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return fifo->space_fd;
+}
+
+void fifo_set_watermarks(fifo_t * fifo, uint32_t high, uint32_t low,
+                         fifo_watermark_fn_t fn, void * arg) {
+	fifo->high_watermark = high;
+	fifo->low_watermark = low;
+	fifo->watermark_fn = fn;
+	fifo->watermark_arg = arg;
+}
+
+bool fifo_congested(fifo_t * fifo) {
+	return atomic_load_explicit(&fifo->congested, memory_order_relaxed);
+}
+
+void fifo_set_pool(fifo_t * fifo, pool_t * pool) {
 	for (uint32_t i=0; i<fifo->consumers; i++)
-		fifo->read[i] = 0;
+		atomic_store(&cursor(fifo, i)->held, atomic_load(&cursor(fifo, i)->read));
+	fifo->pool = pool;
+}
+
+void * fifo_alloc(fifo_t * fifo, size_t size) {
+	return pool_alloc(fifo->pool, size);
+}
+
+// Frees the rings older than until, or all of them if until is NULL. Only when
+// nobody uses the FIFO.
+static void free_rings(fifo_t * fifo, fifo_ring_t * until) {
+	while (fifo->rings != until) {
+		fifo_ring_t * next = fifo->rings->next;
+		if (fifo->rings->buffer)
+			release_ring(fifo, fifo->rings);
+		free(fifo->rings);
+		fifo->rings = next;
+	}
+}
+
+void fifo_clear(fifo_t * fifo) {
+	fifo_ring_t * ring = atomic_load(&fifo->ring);
+	free_rings(fifo, ring);
+	ring->prev = NULL;
+	atomic_store(&ring->start, 0);
+	fifo->oldest = ring;
+	atomic_store(&fifo->reclaim, FIFO_DETACHED);
+	if (fifo->pool)
+		free_payloads(ring);
+
+	atomic_store(&fifo->write, 0);
+	atomic_store(&fifo->tail, 0);
+
+	for (uint32_t i=0; i<fifo->consumers; i++) {
+		fifo_cursor_t * c = cursor(fifo, i);
+		fifo_seq_t r = atomic_load(&c->read) == FIFO_DETACHED ? FIFO_DETACHED : 0;
+		atomic_store(&c->read, r);
+		atomic_store(&c->held, r);
+		atomic_store(&c->lost, 0);
+	}
+
+	for (uint32_t i=0; i<ring->length; i++)
+		atomic_store(&ring->buffer[i].seq, 0);
+}
+
+bool fifo_attach(fifo_t * fifo, uint32_t * consumer) {
+	for (uint32_t i=0; i<fifo->consumers; i++) {
+		fifo_seq_t r = FIFO_DETACHED;
+		if (!atomic_compare_exchange_strong(&cursor(fifo, i)->read, &r, FIFO_ATTACHING))
+			continue;
+
+		cursor(fifo, i)->wait = fifo->wait;
+		fifo->group[i] = false;
+		atomic_store(&cursor(fifo, i)->lost, 0);
+		// One attach at a time: the epoch must stay odd until every attach that
+		// started is done, or slowest_read could miss one
+		uint32_t epoch = atomic_load(&fifo->attach_epoch);
+		do {
+			while (epoch & 1) {
+				spin_relax();
+				epoch = atomic_load(&fifo->attach_epoch);
+			}
+		} while (!atomic_compare_exchange_weak(&fifo->attach_epoch, &epoch, epoch + 1));
+		fifo_seq_t start = atomic_load(&fifo->write);
+		atomic_store(&cursor(fifo, i)->held, start);
+		atomic_store(&cursor(fifo, i)->read, start);
+		atomic_store(&fifo->attach_epoch, epoch + 2);
+
+		*consumer = i;
+		return true;
+	}
+	return false;
+}
+
+void fifo_detach(fifo_t * fifo, uint32_t consumer) {
+	atomic_store(&cursor(fifo, consumer)->held, FIFO_DETACHED);
+	atomic_store(&cursor(fifo, consumer)->read, FIFO_DETACHED);
+	space_freed(fifo);
+	// It may have been the last consumer in an old ring
+	if (atomic_load(&fifo->reclaim) != FIFO_DETACHED)
+		release_old(fifo);
+}
 
-	for (uint32_t i=0; i<fifo->length; i++)
-		sem_set(&fifo->sem_pop[i], 0);
+bool fifo_resize(fifo_t * fifo, uint32_t length) {
+	if (!resizable(fifo))
+		return false;
+	pthread_mutex_lock(&fifo->resize_mutex);
+	start_ring(fifo, length);
+	pthread_mutex_unlock(&fifo->resize_mutex);
+	return true;
+}
 
-	sem_set(&fifo->sem_push, fifo->length-1);
-	pthread_mutex_unlock(&fifo->mutex);
+uint32_t fifo_length(fifo_t * fifo) {
+	return atomic_load_explicit(&fifo->ring, memory_order_acquire)->length;
 }
 
 void fifo_push(fifo_t * fifo, void * p) {
-	sem_wait(&fifo->sem_push);
-	pthread_mutex_lock(&fifo->mutex);
-	fifo->buffer[fifo->write] = p;
-	uint32_t w = fifo->write;
-	fifo->write = (fifo->write + 1) % fifo->length;
-	pthread_mutex_unlock(&fifo->mutex);
-	sem_set(&fifo->sem_pop[w], fifo->consumers);
+	fifo_seq_t seq;
+	// To grow, the FIFO must be found full before claiming
+	if (fifo->max_length) {
+		claim_space(fifo, &seq, 1, true, NULL);
+	} else {
+		seq = claim(fifo, 1);
+		wait_space(fifo, seq, NULL);
+	}
+	publish(fifo, seq, p);
+	STATS(stats_pushed(fifo, 1);)
+	watch_high(fifo);
+}
+
+bool fifo_try_push(fifo_t * fifo, void * p) {
+	fifo_seq_t seq;
+	if (!claim_space(fifo, &seq, 1, false, NULL)
+	    && !(arm_space_fd(fifo) && claim_space(fifo, &seq, 1, false, NULL))) {
+		STATS(stats_pushed(fifo, 0);)
+		return false;
+	}
+	publish(fifo, seq, p);
+	STATS(stats_pushed(fifo, 1);)
+	watch_high(fifo);
+	return true;
+}
+
+bool fifo_timed_push(fifo_t * fifo, void * p, const struct timespec * deadline) {
+	fifo_seq_t seq;
+	if (!claim_space(fifo, &seq, 1, true, deadline)) {
+		STATS(stats_pushed(fifo, 0);)
+		return false;
+	}
+	publish(fifo, seq, p);
+	STATS(stats_pushed(fifo, 1);)
+	watch_high(fifo);
+	return true;
+}
+
+void fifo_push_n(fifo_t * fifo, void * const * ptrs, uint32_t n) {
+	while (n) {
+		uint32_t length = fifo_length(fifo);
+		uint32_t count = n < length ? n : length;
+		// With max_length, grows first if the batch doesn't fit
+		if (fifo->max_length
+		    && !has_space(fifo, atomic_load_explicit(&fifo->write, memory_order_relaxed)
+		                        + count - 1)
+		    && grow(fifo))
+			continue;
+
+		fifo_seq_t seq = claim(fifo, count);
+		fifo_ring_t * last = ring_of(fifo, seq + count - 1);
+		if (last != ring_of(fifo, seq) || count > last->length) {
+			// A resize split the batch or made it longer than the FIFO, so the last
+			// ones may only have space once the first ones are read
+			for (uint32_t i=0; i<count; i++) {
+				wait_space(fifo, seq + i, NULL);
+				publish(fifo, seq + i, ptrs[i]);
+			}
+		} else {
+			// Space for the last one means space for the whole batch
+			wait_space(fifo, seq + count - 1, NULL);
+
+			for (uint32_t i=0; i<count; i++) {
+				// Positions may be freed out of order by overwriting producers
+				if (fifo->overwrite)
+					wait_space(fifo, seq + i, NULL);
+				store(fifo, seq + i, ptrs[i]);
+				STATS(stats_stamp(fifo, seq + i);)
+				atomic_store_explicit(&slot(fifo, seq + i)->seq, seq + i + 1,
+				                      memory_order_release);
+			}
+
+			atomic_thread_fence(memory_order_seq_cst);
+			for (uint32_t i=0; i<count && i<FIFO_WAIT_BUCKETS; i++)
+				wake_waiters(pop_waiters(fifo, seq + i));
+			wake_watchers(fifo);
+		}
+
+		STATS(stats_pushed(fifo, count);)
+		watch_high(fifo);
+		ptrs += count;
+		n -= count;
+	}
+}
+
+// Claims count positions for a credit
+static bool reserve(fifo_t * fifo, uint32_t count, fifo_credit_t * credit, bool block) {
+	credit->left = 0;
+	if (!count || count > fifo_length(fifo) || fifo->overwrite)
+		return false;
+	fifo_seq_t seq;
+	bool ok = claim_space(fifo, &seq, count, block, NULL);
+	// Like fifo_try_push, arms the space eventfd when there is no space
+	if (!ok && !block)
+		ok = arm_space_fd(fifo) && claim_space(fifo, &seq, count, false, NULL);
+	if (!ok)
+		return false;
+	credit->next = seq;
+	credit->left = count;
+	watch_high(fifo);
+	return true;
+}
+
+bool fifo_reserve(fifo_t * fifo, uint32_t count, fifo_credit_t * credit) {
+	return reserve(fifo, count, credit, true);
+}
+
+bool fifo_try_reserve(fifo_t * fifo, uint32_t count, fifo_credit_t * credit) {
+	return reserve(fifo, count, credit, false);
+}
+
+bool fifo_push_credit(fifo_t * fifo, fifo_credit_t * credit, void * p) {
+	if (!credit->left)
+		return false;
+	fifo_seq_t seq = credit->next++;
+	credit->left--;
+	// Only waits if a resize made the FIFO shorter than the reservation
+	wait_space(fifo, seq, NULL);
+	publish(fifo, seq, p);
+	STATS(stats_pushed(fifo, 1);)
+	return true;
+}
+
+fifo_seq_t fifo_pop(fifo_t * fifo, uint32_t consumer, void ** out) {
+	if (fifo->group[consumer]) {
+		pop_group(fifo, consumer, out, 1, true, NULL);
+		return 0;
+	}
+	fifo_seq_t seq = atomic_load_explicit(&cursor(fifo, consumer)->read,
+	                                      memory_order_relaxed);
+	wait_published(fifo, consumer, seq, NULL);
+	return consume(fifo, consumer, seq, out);
+}
+
+bool fifo_try_pop(fifo_t * fifo, uint32_t consumer, void ** out) {
+	return fifo_try_pop_n(fifo, consumer, out, 1);
 }
 
-void fifo_pop(fifo_t * fifo, uint32_t consumer, void ** out) {
-	uint32_t r = fifo->read[consumer];
-	uint32_t remaining = sem_wait(&fifo->sem_pop[r]);
+// Pops up to max readable pointers starting at seq
+static uint32_t take_n(fifo_t * fifo, uint32_t consumer, fifo_seq_t seq, void ** out,
+                       uint32_t max) {
+	uint32_t count = 0;
+	if (fifo->overwrite) {
+		// Stops at the first one not published yet or already replaced
+		seq = read_lossy(fifo, consumer, seq, &out[0]);
+		for (count=1; count < max && read_slot(fifo, seq + count, &out[count]); count++);
+	} else {
+		do {
+			out[count] = slot_data(fifo, seq + count);
+			count++;
+		} while (count < max && is_published(fifo, seq + count));
+	}
 
-	fifo->read[consumer] = (r + 1) % fifo->length;
+	STATS(stats_popped(fifo, consumer, seq, slot_stamp(fifo, seq), count);)
+	mark_read(fifo, consumer, seq, seq + count);
+	return count;
+}
+
+uint32_t fifo_try_pop_n(fifo_t * fifo, uint32_t consumer, void ** out, uint32_t max) {
+	if (fifo->group[consumer]) {
+		uint32_t count = pop_group(fifo, consumer, out, max, false, NULL);
+		if (!count && arm_consumer_fd(fifo, consumer))
+			count = pop_group(fifo, consumer, out, max, false, NULL);
+		return count;
+	}
+	fifo_seq_t seq = atomic_load_explicit(&cursor(fifo, consumer)->read,
+	                                      memory_order_relaxed);
+	if (!is_readable(fifo, seq) && !arm_consumer_fd(fifo, consumer)) {
+		STATS(stats_popped(fifo, consumer, seq, 0, 0);)
+		return 0;
+	}
+	return take_n(fifo, consumer, seq, out, max);
+}
+
+bool fifo_timed_pop(fifo_t * fifo, uint32_t consumer, void ** out,
+                    const struct timespec * deadline) {
+	if (fifo->group[consumer])
+		return pop_group(fifo, consumer, out, 1, true, deadline);
+	fifo_seq_t seq = atomic_load_explicit(&cursor(fifo, consumer)->read,
+	                                      memory_order_relaxed);
+	if (!wait_published(fifo, consumer, seq, deadline)) {
+		STATS(stats_popped(fifo, consumer, seq, 0, 0);)
+		return false;
+	}
+	consume(fifo, consumer, seq, out);
+	return true;
+}
+
+uint32_t fifo_pop_n(fifo_t * fifo, uint32_t consumer, void ** out, uint32_t max) {
+	if (fifo->group[consumer])
+		return pop_group(fifo, consumer, out, max, true, NULL);
+	fifo_seq_t seq = atomic_load_explicit(&cursor(fifo, consumer)->read,
+	                                      memory_order_relaxed);
+	wait_published(fifo, consumer, seq, NULL);
+	return take_n(fifo, consumer, seq, out, max);
+}
+
+fifo_seq_t fifo_lost(fifo_t * fifo, uint32_t consumer) {
+	return atomic_load_explicit(&cursor(fifo, consumer)->lost, memory_order_relaxed);
+}
+
+bool fifo_stats(fifo_t * fifo, fifo_stats_t * stats, fifo_consumer_stats_t * consumers) {
+	memset(stats, 0, sizeof(fifo_stats_t));
+	if (consumers)
+		memset(consumers, 0, fifo->consumers * sizeof(fifo_consumer_stats_t));
+#ifdef FIFO_STATS
+	fifo_consumer_stats_t all = {0};
+	pthread_mutex_lock(&fifo->stats_mutex);
+	for (fifo_stats_block_t * b = fifo->stats_blocks; b; b = b->next) {
+		stats->push_calls += load(&b->push_calls);
+		stats->pushed += load(&b->pushed);
+		stats->blocked_pushes += load(&b->blocked_pushes);
+		stats->push_wait_ns += load(&b->push_wait_ns);
+		for (int i=0; i<FIFO_STATS_BUCKETS; i++)
+			stats->occupancy[i] += load(&b->occupancy[i]);
+		for (uint32_t i=0; i<fifo->consumers; i++) {
+			sum_consumer(&all, &b->consumer[i]);
+			if (consumers)
+				sum_consumer(&consumers[i], &b->consumer[i]);
+		}
+	}
+	pthread_mutex_unlock(&fifo->stats_mutex);
+
+	stats->pop_calls = all.pop_calls;
+	stats->popped = all.popped;
+	stats->blocked_pops = all.blocked_pops;
+	stats->pop_wait_ns = all.wait_ns;
+	memcpy(stats->latency_ns, all.latency_ns, sizeof(all.latency_ns));
+	return true;
+#else
+	return false;
+#endif
+}
+
+void * fifo_claim(fifo_t * fifo, fifo_seq_t * seq) {
+	if (fifo->max_length) {
+		claim_space(fifo, seq, 1, true, NULL);
+	} else {
+		*seq = claim(fifo, 1);
+		wait_space(fifo, *seq, NULL);
+	}
+	STATS(stats_pushed(fifo, 1);)
+	watch_high(fifo);
+	return record(fifo, *seq);
+}
+
+void fifo_publish(fifo_t * fifo, fifo_seq_t seq) {
+	mark_published(fifo, seq);
+}
+
+const void * fifo_read(fifo_t * fifo, uint32_t consumer) {
+	fifo_seq_t seq = atomic_load_explicit(&cursor(fifo, consumer)->read,
+	                                      memory_order_relaxed);
+	wait_published(fifo, consumer, seq, NULL);
+	STATS(stats_popped(fifo, consumer, seq, slot_stamp(fifo, seq), 1);)
+	return record(fifo, seq);
+}
+
+void fifo_release(fifo_t * fifo, uint32_t consumer) {
+	fifo_seq_t seq = atomic_load_explicit(&cursor(fifo, consumer)->read,
+	                                      memory_order_relaxed);
+	mark_read(fifo, consumer, seq, seq + 1);
+}
+
+void fifo_selector_init(fifo_selector_t * sel, const fifo_source_t * sources,
+                        uint32_t count) {
+	fifo_wait_init(&sel->wait);
+	sel->sources = (fifo_source_t *)malloc(count * sizeof(fifo_source_t));
+	sel->count = count;
+	sel->next = 0;
+	for (uint32_t i=0; i<count; i++) {
+		fifo_t * fifo = sources[i].fifo;
+		sel->sources[i] = sources[i];
+		atomic_store(&fifo->selector[sources[i].consumer], &sel->wait);
+		atomic_fetch_add(&fifo->selectors, 1);
+	}
+}
+
+// Index of a source with data, starting after the last one returned so a busy
+// source doesn't starve the others. -1 if none.
+static int select_ready(fifo_selector_t * sel) {
+	for (uint32_t i=0; i<sel->count; i++) {
+		uint32_t k = (sel->next + i) % sel->count;
+		fifo_t * fifo = sel->sources[k].fifo;
+		fifo_seq_t seq = atomic_load_explicit(&cursor(fifo, sel->sources[k].consumer)->read,
+		                                      memory_order_acquire);
+		if (is_readable(fifo, seq)) {
+			sel->next = (k + 1) % sel->count;
+			return k;
+		}
+	}
+	return -1;
+}
+
+// Condition of fifo_select: a source is ready
+typedef struct {
+	fifo_selector_t * sel;
+	int ready;
+} fifo_select_poll_t;
+
+static bool any_ready(void * p) {
+	fifo_select_poll_t * poll = (fifo_select_poll_t *)p;
+	return (poll->ready = select_ready(poll->sel)) >= 0;
+}
+
+int fifo_select(fifo_selector_t * sel, const struct timespec * deadline) {
+	fifo_select_poll_t poll = { sel, -1 };
+	fifo_wait_until(&sel->wait, SPIN_POLLS, any_ready, &poll, deadline);
+	return poll.ready;
+}
 
-	*out = fifo->buffer[r];
-	if (!remaining)
-		sem_signal(&fifo->sem_push);
+void fifo_selector_destroy(fifo_selector_t * sel) {
+	for (uint32_t i=0; i<sel->count; i++) {
+		fifo_t * fifo = sel->sources[i].fifo;
+		atomic_fetch_sub(&fifo->selectors, 1);
+		atomic_store(&fifo->selector[sel->sources[i].consumer], NULL);
+	}
+	fifo_wait_destroy(&sel->wait);
+	free(sel->sources);
 }
 
 void fifo_destroy(fifo_t * fifo) {
-	pthread_mutex_destroy(&fifo->mutex);
-	for (uint32_t i=0; i<fifo->length; i++)
-		sem_destroy(&fifo->sem_pop[i]);
-
-	sem_destroy(&fifo->sem_push);
-	free(fifo->buffer);
-	free(fifo->read);
-	free(fifo->sem_pop);
+	free_rings(fifo, NULL);
+	pthread_mutex_destroy(&fifo->resize_mutex);
+	pthread_mutex_destroy(&fifo->watermark_mutex);
+	for (int i=0; i<FIFO_WAIT_BUCKETS; i++)
+		fifo_wait_destroy(&fifo->wait_pop[i]);
+	fifo_wait_destroy(&fifo->wait_push);
+	if (fifo->node >= 0)
+		node_free(fifo->cursors, fifo->consumers * fifo->cursor_stride);
+	else
+		free(fifo->cursors);
+	free(fifo->group);
+	free((void *)fifo->selector);
+	for (uint32_t i=0; i<fifo->consumers; i++) {
+		if (fifo->consumer_fd[i] >= 0)
+			close(fifo->consumer_fd[i]);
+	}
+	if (fifo->space_fd >= 0)
+		close(fifo->space_fd);
+	free(fifo->consumer_fd);
+#ifdef FIFO_STATS
+	pthread_key_delete(fifo->stats_key);
+	while (fifo->stats_blocks) {
+		fifo_stats_block_t * next = fifo->stats_blocks->next;
+		free(fifo->stats_blocks);
+		fifo->stats_blocks = next;
+	}
+	pthread_mutex_destroy(&fifo->stats_mutex);
+#endif
 }
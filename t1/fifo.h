@@ -1,33 +1,288 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <pthread.h>
-#include "sem.h"
+#include "pool.h"
+#include "spin.h"
 
 /**
  * @defgroup fifo FIFO
- * @brief Thread-safe pointer FIFO for multiple consumers.
- *        All consumers must pop a pointer for the space become available.
+ * @brief Lock-free pointer FIFO for multiple producers and multiple consumers.
+ *        Every consumer reads every pointer (broadcast).
+ *        All attached consumers must pop a pointer for the space become available.
+ *        Consumers can attach and detach while the FIFO is in use (fifo_attach).
  *        Blocks on push if full.
  *        For each consumer, block on pop if empty.
+ *        In record mode (fifo_init_records) each position stores a fixed size record
+ *        inline instead of a pointer. Producers write it in place between fifo_claim
+ *        and fifo_publish, consumers read it in place between fifo_read and
+ *        fifo_release.
+ *        With a pool (fifo_set_pool), pushed pointers must come from fifo_alloc and
+ *        the FIFO frees them: a payload stays valid for a consumer until its next
+ *        pop, and is freed when a producer reuses its position after every
+ *        consumer moved past it.
+ *        In overwrite mode (fifo_config_t::overwrite) producers never wait for
+ *        consumers: a full FIFO replaces its oldest pointers, and a consumer that
+ *        falls more than length pointers behind skips to the oldest one left.
+ *        A consumer ID can also be a group of competing consumers (fifo_set_group):
+ *        any number of threads pop with that ID and each pointer goes to only one
+ *        of them, while every other consumer ID still gets all pointers.
+ *        One thread can wait for data on several FIFOs with a selector (fifo_select),
+ *        and event loops can wait on eventfds (fifo_consumer_fd, fifo_space_fd).
+ *        The length can change while the FIFO is in use (fifo_resize): producers
+ *        move to a new buffer right away and consumers finish the old one first.
+ *        With fifo_config_t::max_length, producers grow a full FIFO themselves.
+ *        Occupancy watermarks (fifo_set_watermarks) tell producers to slow down
+ *        before the FIFO is full, and a producer can reserve positions for a
+ *        burst ahead of time (fifo_reserve), so its pushes never block.
+ *        On NUMA machines (fifo_config_t::numa) the buffers go on the producers'
+ *        node and each consumer's state on its own node (see node.h).
+ *        Built with FIFO_STATS, it counts pushes, pops and waits, and samples
+ *        occupancy, lag and latency (fifo_stats).
  * @{
  */
 
 /**
- * @brief pointer FIFO instance
+ * @brief Sequence number of a pushed pointer. 64 bits, so it never wraps in practice.
+ *        The position of sequence s in the buffer is s % length.
+ */
+typedef uint64_t fifo_seq_t;
+
+/** @brief Read sequence of a consumer ID nobody is using */
+#define FIFO_DETACHED  UINT64_MAX
+/** @brief Read sequence of a consumer ID being attached */
+#define FIFO_ATTACHING (UINT64_MAX - 1)
+/** @brief Slot sequence while an overwriting producer writes it */
+#define FIFO_WRITING   UINT64_MAX
+/** @brief First sequence of a ring while fifo_resize starts it */
+#define FIFO_RESIZING  UINT64_MAX
+
+/**
+ * @brief One FIFO position: the data and the sequence it belongs to.
+ *        Kept together so a pop touches a single cache line. data and stamp are
+ *        atomic (accessed relaxed) because group members and lapped consumers
+ *        copy them while a producer may be replacing them, then check seq.
+ */
+typedef struct {
+	_Atomic fifo_seq_t seq;    /**< Sequence + 1 of the data, 0 if never written */
+	_Atomic(void *) data;
+#ifdef FIFO_STATS
+	_Atomic uint64_t stamp;    /**< Publish time (ns) of sampled pushes, 0 if not sampled */
+#endif
+} fifo_slot_t;
+
+/**
+ * @brief Number of wait objects consumers park on. Sequence s uses s % FIFO_WAIT_BUCKETS,
+ *        so a push only wakes the consumers waiting for that sequence.
+ */
+#define FIFO_WAIT_BUCKETS 8
+
+/**
+ * @brief How a thread waits for data (consumers) or space (producers)
+ */
+typedef enum {
+	FIFO_WAIT_HYBRID = 0,      /**< Spin, then yield, for a few microseconds, then park */
+	FIFO_WAIT_SPIN,            /**< Busy-spin with a pause hint, never sleeps    */
+	FIFO_WAIT_YIELD,           /**< Spin briefly, then sched_yield between polls */
+	FIFO_WAIT_BLOCK,           /**< Park right away                              */
+} fifo_wait_strategy_t;
+
+/**
+ * @brief FIFO options. Zero initialized fields take the default.
+ */
+typedef struct {
+	uint32_t length;                /**< FIFO length                             */
+	uint32_t consumers;             /**< Number of consumers attached from the start */
+	uint32_t max_consumers;         /**< Room for consumers attached later with
+	                                     fifo_attach, at least consumers          */
+	size_t record_size;             /**< Record size for record mode, 0 for pointers */
+	fifo_wait_strategy_t wait;      /**< Wait strategy for producers and consumers */
+	bool single_producer;           /**< Only one thread pushes: claims without atomic
+	                                     read-modify-write operations */
+	bool overwrite;                 /**< Replace the oldest pointers when full instead
+	                                     of blocking. Pointer mode, without a pool */
+	uint32_t max_length;            /**< Producers that find the FIFO full double its
+	                                     length up to this (fifo_resize), 0 to never
+	                                     grow */
+	bool numa;                      /**< Place the buffers on producer_node and each
+	                                     consumer's cursor on its node             */
+	int producer_node;              /**< Node of the producers, with numa        */
+	const int * consumer_nodes;     /**< With numa, node of each consumer ID (as many
+	                                     as max_consumers, or consumers if larger),
+	                                     NULL for producer_node                    */
+} fifo_config_t;
+
+/**
+ * @brief Buckets of the stats histograms. Bucket 0 counts zeros, bucket i counts
+ *        values from 2^(i-1) to 2^i - 1, and the last one also every larger value.
+ */
+#define FIFO_STATS_BUCKETS 32
+
+/**
+ * @brief With stats, each thread samples one in FIFO_STATS_SAMPLE pushes for the
+ *        latency and occupancy histograms, and one in FIFO_STATS_SAMPLE pops for
+ *        the lag histogram
+ */
+#define FIFO_STATS_SAMPLE 16
+
+/**
+ * @brief Counters of one consumer ID, summed over the threads that used it
+ */
+typedef struct {
+	uint64_t pop_calls;             /**< Pop calls, including the ones that got nothing */
+	uint64_t popped;                /**< Pointers or records popped              */
+	uint64_t blocked_pops;          /**< Times the consumer had to wait for data */
+	uint64_t wait_ns;               /**< Time spent waiting for data             */
+	uint64_t lag[FIFO_STATS_BUCKETS];        /**< Pushed but not popped yet, at pops */
+	uint64_t latency_ns[FIFO_STATS_BUCKETS]; /**< Publish to pop time            */
+} fifo_consumer_stats_t;
+
+/**
+ * @brief Snapshot of the FIFO counters (fifo_stats)
+ */
+typedef struct {
+	uint64_t push_calls;            /**< Push and claim calls, including failed tries */
+	uint64_t pushed;                /**< Pointers or records pushed              */
+	uint64_t blocked_pushes;        /**< Times a producer had to wait for space  */
+	uint64_t push_wait_ns;          /**< Time producers spent waiting for space  */
+	uint64_t pop_calls;             /**< Of all consumers                        */
+	uint64_t popped;                /**< Of all consumers                        */
+	uint64_t blocked_pops;          /**< Of all consumers                        */
+	uint64_t pop_wait_ns;           /**< Of all consumers                        */
+	uint64_t occupancy[FIFO_STATS_BUCKETS];  /**< Positions in use, at pushes   */
+	uint64_t latency_ns[FIFO_STATS_BUCKETS]; /**< Of all consumers               */
+} fifo_stats_t;
+
+typedef struct fifo_stats_block fifo_stats_block_t;
+
+/**
+ * @brief Called when the occupancy reaches the high watermark (@p high true), and
+ *        when it drops back to the low one (@p high false). Calls alternate.
+ *
+ * @param[in] arg Argument given to fifo_set_watermarks
+ * @param[in] high true if the FIFO became congested
+ */
+typedef void (*fifo_watermark_fn_t)(void * arg, bool high);
+
+/**
+ * @brief Positions reserved by a producer with fifo_reserve
+ */
+typedef struct {
+	fifo_seq_t next;                /**< Next reserved sequence                  */
+	uint32_t left;                  /**< Reserved positions not pushed yet       */
+} fifo_credit_t;
+
+/**
+ * @brief Buffer for the sequences from start until the next ring starts.
+ *        fifo_resize starts a new ring for the producers, while consumers finish
+ *        the old one. Its buffers are released once every consumer moved past it.
+ */
+typedef struct fifo_ring {
+	fifo_slot_t * buffer;           /**< Data area, NULL once released           */
+	uint8_t * records;              /**< Inline records, NULL if not in record mode */
+	uint32_t length;                /**< Ring length                             */
+	_Atomic fifo_seq_t start;       /**< First sequence, FIFO_RESIZING until known */
+	fifo_seq_t end;                 /**< First sequence of the next ring, once there
+	                                     is one                                   */
+	struct fifo_ring * prev;        /**< Older ring, NULL for the first one      */
+	struct fifo_ring * next;        /**< Newer ring, NULL for the current one    */
+} fifo_ring_t;
+
+/**
+ * @brief State of one consumer ID, written by its consumer and read by producers.
+ *        Each one has its own cache line, so consumers never share lines with
+ *        each other. With fifo_config_t::numa each one has its own page, on the
+ *        consumer's node.
+ */
+typedef struct {
+	_Alignas(64) _Atomic fifo_seq_t read; /**< Next sequence to read, FIFO_DETACHED
+	                                     if the ID is free                        */
+	_Atomic fifo_seq_t held;        /**< With a pool, first sequence still in use */
+	_Atomic fifo_seq_t lost;        /**< Pointers missed in overwrite mode       */
+	atomic_bool fd_armed;           /**< Found the FIFO empty, signal its eventfd */
+	uint8_t wait;                   /**< Wait strategy                           */
+} fifo_cursor_t;
+
+/**
+ * @brief Shared wait object. Threads spin for a while and then park here.
+ *        Wakers only take the mutex if there is a waiter.
  */
 typedef struct {
-	void ** buffer;            /**< Data area                                */
-	uint32_t write;            /**< Next write position                      */
-	uint32_t * read;           /**< Oldest data position for each consumer   */
-	uint32_t length;           /**< FIFO length                              */
-	uint32_t consumers;        /**< Number of consumers                      */
-	semaphore_t * sem_pop;     /**< Semaphores to block on pop               */
-	semaphore_t sem_push;      /**< Block on push semaphore                  */
 	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	atomic_uint waiters;       /**< Number of parked threads                 */
+} fifo_wait_t;
+
+/**
+ * @brief pointer FIFO instance
+ */
+typedef struct {
+	_Atomic(fifo_ring_t *) ring;    /**< Ring the producers use                  */
+	fifo_ring_t * rings;            /**< Oldest ring, kept until fifo_destroy    */
+	fifo_ring_t * oldest;           /**< Oldest ring not released yet            */
+	_Atomic fifo_seq_t reclaim;     /**< End of the oldest ring if it isn't the
+	                                     current one, FIFO_DETACHED otherwise     */
+	pthread_mutex_t resize_mutex;   /**< Serializes resizes and releases         */
+	uint32_t max_length;            /**< Auto growth limit, 0 if disabled        */
+	size_t record_size;             /**< Size of each record (aligned)           */
+	pool_t * pool;                  /**< Payload pool, NULL if not used          */
+	fifo_cursor_t * cursors;        /**< Of each consumer ID, cursor_stride apart */
+	size_t cursor_stride;           /**< Bytes from a cursor to the next         */
+	int node;                       /**< Node of the buffers, -1 without numa    */
+	atomic_uint attach_epoch;       /**< Odd while a consumer is attaching, one at
+	                                     a time                                   */
+	_Atomic fifo_seq_t write;       /**< Next sequence to be claimed by a producer */
+	_Atomic fifo_seq_t tail;        /**< Cached slowest consumer read sequence   */
+	uint32_t consumers;             /**< Number of consumer IDs                  */
+	fifo_wait_strategy_t wait;      /**< Wait strategy of the producers          */
+	bool single_producer;           /**< Only one thread pushes                  */
+	bool overwrite;                 /**< Overwrite mode                          */
+	bool * group;                   /**< Consumers shared by competing threads   */
+	_Atomic(fifo_wait_t *) * selector; /**< Selector watching each consumer, or NULL */
+	atomic_uint selectors;          /**< Number of consumers with a selector     */
+	int * consumer_fd;              /**< eventfd of each consumer, -1 if none    */
+	atomic_uint armed_fds;          /**< Consumers with fd_armed set             */
+	int space_fd;                   /**< Producer eventfd, -1 if none            */
+	atomic_bool space_armed;        /**< A producer found the FIFO full          */
+	uint32_t high_watermark;        /**< Occupancy that makes it congested, 0 if
+	                                     not watched                              */
+	uint32_t low_watermark;         /**< Occupancy that ends congestion          */
+	fifo_watermark_fn_t watermark_fn; /**< Called on changes, or NULL            */
+	void * watermark_arg;
+	atomic_bool congested;          /**< Reached high, not back to low yet       */
+	pthread_mutex_t watermark_mutex; /**< Serializes changes and callbacks       */
+	fifo_wait_t wait_pop[FIFO_WAIT_BUCKETS]; /**< Consumers waiting for data     */
+	fifo_wait_t wait_push;          /**< Producers waiting for space             */
+#ifdef FIFO_STATS
+	pthread_mutex_t stats_mutex;    /**< Protects stats_blocks                   */
+	fifo_stats_block_t * stats_blocks; /**< Counters of each thread that used the FIFO */
+	pthread_key_t stats_key;        /**< Counters of the calling thread          */
+#endif
 } fifo_t;
 
+/**
+ * @brief A consumer of a FIFO watched by a selector
+ */
+typedef struct {
+	fifo_t * fifo;
+	uint32_t consumer;
+} fifo_source_t;
+
+/**
+ * @brief Waits for data on several FIFOs (sources) from one consumer thread.
+ *        Producers of any source wake its one wait object.
+ */
+typedef struct {
+	fifo_wait_t wait;               /**< Where the selecting thread parks        */
+	fifo_source_t * sources;        /**< Watched consumers                       */
+	uint32_t count;                 /**< Number of sources                       */
+	uint32_t next;                  /**< Source fifo_select looks at first       */
+} fifo_selector_t;
+
 /**
  * @brief Initializes the FIFO and sets the data area
  *
@@ -38,14 +293,174 @@ typedef struct {
 void fifo_init(fifo_t * fifo, uint32_t length, uint32_t consumers);
 
 /**
- * @brief Removes all data from the FIFO
+ * @brief Initializes the FIFO in record mode
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] length Length of FIFO
+ * @param[in] consumers Number of consumers
+ * @param[in] record_size Size of each record in bytes
+ */
+void fifo_init_records(fifo_t * fifo, uint32_t length, uint32_t consumers,
+                       size_t record_size);
+
+/**
+ * @brief Initializes the FIFO with the given options
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] config FIFO options
+ */
+void fifo_init_config(fifo_t * fifo, const fifo_config_t * config);
+
+/**
+ * @brief Adds a consumer while the FIFO is in use. It reads everything pushed from
+ *        now on. Uses a free consumer ID, up to max_consumers.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[out] consumer ID of the new consumer
+ * @return false if all consumer IDs are in use
+ */
+bool fifo_attach(fifo_t * fifo, uint32_t * consumer);
+
+/**
+ * @brief Removes a consumer while the FIFO is in use. What it didn't pop no longer
+ *        holds back the producers, and its ID can be reused by fifo_attach.
+ *        The consumer must not be in a pop call.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] consumer ID of the consumer
+ */
+void fifo_detach(fifo_t * fifo, uint32_t consumer);
+
+/**
+ * @brief Changes how one consumer waits, overriding the FIFO wait strategy.
+ *        Must be called by that consumer or before it starts.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @param[in] strategy Wait strategy
+ */
+void fifo_set_consumer_wait(fifo_t * fifo, uint32_t consumer,
+                            fifo_wait_strategy_t strategy);
+
+/**
+ * @brief Makes @p consumer a group of competing consumers. Any number of threads
+ *        can pop with its ID, and each pointer goes to only one of them. They share
+ *        one read sequence, so a position is free once every other consumer and
+ *        one member of the group popped it.
+ *        Must be called before the consumer starts. Pointer mode only, without a
+ *        pool or overwrite mode. A FIFO with groups can't be resized.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ */
+void fifo_set_group(fifo_t * fifo, uint32_t consumer);
+
+/**
+ * @brief Creates an eventfd for @p consumer, for event loops. It is signaled when
+ *        the FIFO stops being empty for the consumer: by the first push after a
+ *        fifo_try_pop or fifo_try_pop_n call that found nothing. To use it, wait
+ *        until it is readable, read it to reset it, and pop with fifo_try_pop_n
+ *        until it returns 0.
+ *        Must be called before the consumer starts. Closed by fifo_destroy.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @return The eventfd (non-blocking), -1 on error (see errno)
+ */
+int fifo_consumer_fd(fifo_t * fifo, uint32_t consumer);
+
+/**
+ * @brief Creates an eventfd for producers, for event loops. It is signaled when
+ *        there is space again after a fifo_try_push call found the FIFO full.
+ *        Must be called before the producers start. Closed by fifo_destroy.
+ *
+ * @param[in] fifo The FIFO instance
+ * @return The eventfd (non-blocking), -1 on error (see errno)
+ */
+int fifo_space_fd(fifo_t * fifo);
+
+/**
+ * @brief Watches the occupancy (positions pushed or reserved and not read by every
+ *        consumer yet). When it reaches @p high, the FIFO is congested until it
+ *        drops to @p low: fifo_congested returns true, and @p fn is called on
+ *        each change by the producer or consumer that made it. @p fn must be
+ *        short and must not push or pop.
+ *        Must be called before the FIFO is used. Not in overwrite mode.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] high High watermark (> @p low)
+ * @param[in] low Low watermark
+ * @param[in] fn Callback, or NULL to only use fifo_congested
+ * @param[in] arg Argument of fn
+ */
+void fifo_set_watermarks(fifo_t * fifo, uint32_t high, uint32_t low,
+                         fifo_watermark_fn_t fn, void * arg);
+
+/**
+ * @brief Tells producers to slow down, see fifo_set_watermarks. A single load,
+ *        cheap enough to check before every push.
+ *
+ * @param[in] fifo The FIFO instance
+ * @return true between reaching the high watermark and dropping to the low one
+ */
+bool fifo_congested(fifo_t * fifo);
+
+/**
+ * @brief Makes the FIFO own the payloads pushed to it, allocated from @p pool.
+ *        Must be called right after the FIFO is initialized (not in record mode).
+ *        The pool must outlive the FIFO.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] pool The pool to allocate payloads from
+ */
+void fifo_set_pool(fifo_t * fifo, pool_t * pool);
+
+/**
+ * @brief Allocates a payload from the FIFO pool. Once pushed, it is freed by the FIFO.
+ *
+ * @param[in] fifo The FIFO instance (with a pool)
+ * @param[in] size Payload size in bytes
+ * @return The payload, aligned for any type
+ */
+void * fifo_alloc(fifo_t * fifo, size_t size);
+
+/**
+ * @brief Changes the length of the FIFO while it is in use. Producers write to a
+ *        new buffer of @p length positions from now on, and consumers read the
+ *        pointers left in the old one before moving to it, so every consumer still
+ *        reads every pointer, in the order each producer pushed them. The old
+ *        buffer is released once every consumer moved past it.
+ *        Not in overwrite mode or with groups. With single_producer, only the
+ *        producer can call it.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] length New length (> 0). With a pool, at least 2: each consumer holds
+ *            the position of its last pop.
+ * @return false if the FIFO can't be resized
+ */
+bool fifo_resize(fifo_t * fifo, uint32_t length);
+
+/**
+ * @brief Current length of the FIFO
+ *
+ * @param[in] fifo The FIFO instance
+ * @return Length of the buffer producers write to
+ */
+uint32_t fifo_length(fifo_t * fifo);
+
+/**
+ * @brief Removes all data from the FIFO and restarts the sequences at 0.
+ *        Must not be called while other threads are using the FIFO: producers and
+ *        consumers don't take a lock, so unlike the mutex based FIFO this can't
+ *        wait for them. Join or stop them first (they may be attached again after).
  *
  * @param[in] fifo The FIFO instance
  */
 void fifo_clear(fifo_t * fifo);
 
 /**
- * @brief Adds a pointer to the FIFO. If the FIFO is full, the oldest pointer is replaced
+ * @brief Adds a pointer to the FIFO. If the FIFO is full, blocks until every consumer
+ *        pops the oldest pointer, or replaces it in overwrite mode.
  *
  * @param[in] fifo The FIFO instance
  * @param[in] p The pointer to add
@@ -53,13 +468,226 @@ void fifo_clear(fifo_t * fifo);
 void fifo_push(fifo_t * fifo, void * p);
 
 /**
- * @brief Copy the oldest pointer to @p out and removes it from the FIFO
+ * @brief Adds a pointer to the FIFO if there is space, never blocks
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] p The pointer to add
+ * @return true if the pointer was added
+ */
+bool fifo_try_push(fifo_t * fifo, void * p);
+
+/**
+ * @brief Adds a pointer to the FIFO, blocking until @p deadline if it is full
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] p The pointer to add
+ * @param[in] deadline Absolute CLOCK_MONOTONIC time
+ * @return true if the pointer was added, false on timeout
+ */
+bool fifo_timed_push(fifo_t * fifo, void * p, const struct timespec * deadline);
+
+/**
+ * @brief Adds @p n pointers to the FIFO. Up to length positions are claimed at
+ *        once and published together, so pointers from a batch are contiguous
+ *        unless @p n is larger than the FIFO. Blocks until all are added.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] ptrs The pointers to add
+ * @param[in] n Number of pointers in @p ptrs
+ */
+void fifo_push_n(fifo_t * fifo, void * const * ptrs, uint32_t n);
+
+/**
+ * @brief Reserves @p count consecutive positions for the calling producer, blocking
+ *        until there is space for all of them. Pushes with the credit then never
+ *        block (unless the FIFO is resized meanwhile). Consumers read the reserved
+ *        positions in order, so they wait at the first one not pushed yet: the
+ *        credit must be used in full, soon.
+ *        Pointer mode, not in overwrite mode.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] count Number of positions
+ * @param[out] credit The reservation, for fifo_push_credit
+ * @return false if @p count is 0 or larger than the FIFO
+ */
+bool fifo_reserve(fifo_t * fifo, uint32_t count, fifo_credit_t * credit);
+
+/**
+ * @brief Like fifo_reserve, but never blocks
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] count Number of positions
+ * @param[out] credit The reservation, for fifo_push_credit
+ * @return false if there isn't space for @p count pointers now
+ */
+bool fifo_try_reserve(fifo_t * fifo, uint32_t count, fifo_credit_t * credit);
+
+/**
+ * @brief Adds a pointer to the next position reserved by @p credit
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in,out] credit Reservation from fifo_reserve or fifo_try_reserve
+ * @param[in] p The pointer to add
+ * @return false if the credit was already used up
+ */
+bool fifo_push_credit(fifo_t * fifo, fifo_credit_t * credit, void * p);
+
+/**
+ * @brief Copy the oldest pointer to @p out and removes it from the FIFO.
+ *        In overwrite mode, if producers replaced pointers this consumer didn't pop
+ *        yet, it skips to the oldest pointer left. Every pop function does this,
+ *        and fifo_lost counts the pointers skipped.
  *
  * @param[in] fifo The FIFO instance
  * @param[in] consumer ID of the consumer (0 to consumers - 1)
  * @param[out] out Copy destination
+ * @return Number of pointers skipped before this one (lag), always 0 if not in
+ *         overwrite mode
+ */
+fifo_seq_t fifo_pop(fifo_t * fifo, uint32_t consumer, void ** out);
+
+/**
+ * @brief Copy the oldest pointer to @p out and removes it from the FIFO if there is
+ *        one, never blocks
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @param[out] out Copy destination
+ * @return true if a pointer was copied to @p out
+ */
+bool fifo_try_pop(fifo_t * fifo, uint32_t consumer, void ** out);
+
+/**
+ * @brief Copy the oldest pointer to @p out and removes it from the FIFO, blocking
+ *        until @p deadline if it is empty
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @param[out] out Copy destination
+ * @param[in] deadline Absolute CLOCK_MONOTONIC time
+ * @return true if a pointer was copied to @p out, false on timeout
+ */
+bool fifo_timed_pop(fifo_t * fifo, uint32_t consumer, void ** out,
+                    const struct timespec * deadline);
+
+/**
+ * @brief Copy all pointers available to @p consumer (up to @p max) to @p out and
+ *        removes them from the FIFO. Blocks only if there are none.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @param[out] out Copy destination, room for @p max pointers
+ * @param[in] max Maximum number of pointers to pop (> 0)
+ * @return Number of pointers copied to @p out
  */
-void fifo_pop(fifo_t * fifo, uint32_t consumer, void ** out);
+uint32_t fifo_pop_n(fifo_t * fifo, uint32_t consumer, void ** out, uint32_t max);
+
+/**
+ * @brief Like fifo_pop_n, but never blocks
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @param[out] out Copy destination, room for @p max pointers
+ * @param[in] max Maximum number of pointers to pop (> 0)
+ * @return Number of pointers copied to @p out, 0 if there are none
+ */
+uint32_t fifo_try_pop_n(fifo_t * fifo, uint32_t consumer, void ** out, uint32_t max);
+
+/**
+ * @brief Number of pointers @p consumer missed in overwrite mode since it was
+ *        initialized, cleared or attached. Any thread can call it.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @return Pointers skipped
+ */
+fifo_seq_t fifo_lost(fifo_t * fifo, uint32_t consumer);
+
+/**
+ * @brief Snapshot of the counters of the FIFO since it was initialized.
+ *        Counters are only kept if built with FIFO_STATS defined (make STATS=1),
+ *        then each thread updates its own copy and this sums them. Without it
+ *        they cost nothing and are all zero.
+ *        Any thread can call it. Threads in a push or pop call may not have
+ *        counted it yet.
+ *
+ * @param[in] fifo The FIFO instance
+ * @param[out] stats Counters of the whole FIFO
+ * @param[out] consumers Counters of each consumer ID, room for every consumer ID
+ *             (max_consumers), or NULL
+ * @return false if built without FIFO_STATS
+ */
+bool fifo_stats(fifo_t * fifo, fifo_stats_t * stats, fifo_consumer_stats_t * consumers);
+
+/**
+ * @brief Claims the next record, blocking if the FIFO is full.
+ *        The record must be written and then published with fifo_publish.
+ *        Records are read in the order they were claimed, so a claimed record
+ *        holds back the ones after it until it is published.
+ *
+ * @param[in] fifo The FIFO instance (record mode)
+ * @param[out] seq Sequence of the claimed record, to pass to fifo_publish
+ * @return Pointer to the record inside the FIFO
+ */
+void * fifo_claim(fifo_t * fifo, fifo_seq_t * seq);
+
+/**
+ * @brief Makes a record claimed with fifo_claim visible to the consumers
+ *
+ * @param[in] fifo The FIFO instance (record mode)
+ * @param[in] seq Sequence returned by fifo_claim
+ */
+void fifo_publish(fifo_t * fifo, fifo_seq_t seq);
+
+/**
+ * @brief Returns the oldest record for @p consumer, blocking if there is none.
+ *        The record stays valid until fifo_release is called.
+ *
+ * @param[in] fifo The FIFO instance (record mode)
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @return Pointer to the record inside the FIFO
+ */
+const void * fifo_read(fifo_t * fifo, uint32_t consumer);
+
+/**
+ * @brief Removes the record returned by fifo_read for @p consumer from the FIFO
+ *
+ * @param[in] fifo The FIFO instance (record mode)
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ */
+void fifo_release(fifo_t * fifo, uint32_t consumer);
+
+/**
+ * @brief Initializes a selector for @p count sources. From now on, producers of
+ *        the source FIFOs also wake the selector. A consumer can be watched by only
+ *        one selector at a time.
+ *
+ * @param[in] sel The selector instance
+ * @param[in] sources FIFO and consumer ID pairs to watch (copied)
+ * @param[in] count Number of sources (> 0)
+ */
+void fifo_selector_init(fifo_selector_t * sel, const fifo_source_t * sources,
+                        uint32_t count);
+
+/**
+ * @brief Blocks until any source has data for its consumer. Doesn't pop: the
+ *        caller pops from the source returned, with fifo_try_pop or fifo_pop_n.
+ *        When several are ready, the sources take turns.
+ *
+ * @param[in] sel The selector instance
+ * @param[in] deadline Absolute CLOCK_MONOTONIC time, or NULL to wait forever
+ * @return Index of the source in the array given to fifo_selector_init, -1 on
+ *         timeout
+ */
+int fifo_select(fifo_selector_t * sel, const struct timespec * deadline);
+
+/**
+ * @brief Stops watching the sources and releases the selector.
+ *        Must not be called while a thread is in fifo_select.
+ *
+ * @param[in] sel The selector instance
+ */
+void fifo_selector_destroy(fifo_selector_t * sel);
 
 /**
  * @brief Releases any resources held by the FIFO
@@ -68,4 +696,43 @@ void fifo_pop(fifo_t * fifo, uint32_t consumer, void ** out);
  */
 void fifo_destroy(fifo_t * fifo);
 
+/**
+ * @brief Initializes a wait object
+ *
+ * @param[in] w The wait object
+ */
+void fifo_wait_init(fifo_wait_t * w);
+
+/**
+ * @brief Wakes every thread parked on @p w, if there is any. Must be called after
+ *        the state change the parked threads wait for.
+ *        To park, a thread locks the mutex, increments waiters, issues a seq_cst
+ *        fence and checks the state again before waiting on the condition.
+ *
+ * @param[in] w The wait object
+ */
+void fifo_wait_wake(fifo_wait_t * w);
+
+/**
+ * @brief Polls @p ready up to @p spins times (spin_until), then parks on @p w
+ *        until it is true. Wakers must follow the protocol of fifo_wait_wake.
+ *        @p ready is called with the mutex of @p w held once parking.
+ *
+ * @param[in] w The wait object
+ * @param[in] spins Polls before parking, 0 to park right away
+ * @param[in] ready Condition
+ * @param[in] arg Argument of ready
+ * @param[in] deadline Absolute CLOCK_MONOTONIC time, or NULL to wait forever
+ * @return false on timeout
+ */
+bool fifo_wait_until(fifo_wait_t * w, uint32_t spins, spin_ready_fn_t ready, void * arg,
+                     const struct timespec * deadline);
+
+/**
+ * @brief Releases any resources held by a wait object
+ *
+ * @param[in] w The wait object
+ */
+void fifo_wait_destroy(fifo_wait_t * w);
+
 /** @} */
@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+#define JOURNAL_MAGIC 0x6c6e72756f6a7470ULL
+#define JOURNAL_SEGMENT_RECORDS 4096
+// Segment file header size, records start after it
+#define SEGMENT_HEADER 64
+// Each record starts with its sequence + 1, written when published
+#define RECORD_HEADER 16
+
+/**
+ * @brief Start of each segment file
+ */
+typedef struct {
+	uint64_t magic;
+	uint64_t first;                 /**< Sequence of the first record            */
+	uint64_t record_size;           /**< Size of each record, with its header    */
+	uint64_t records;               /**< Records in the segment                  */
+	int64_t created;                /**< CLOCK_REALTIME ns when created          */
+} segment_header_t;
+
+struct journal_segment {
+	uint64_t first;                 /**< Sequence of the first record            */
+	uint8_t * base;                 /**< Mapped file                             */
+	size_t size;                    /**< File size                               */
+	atomic_uint refs;               /**< Readers in this segment                 */
+	_Atomic(journal_segment_t *) next; /**< Newer segment, NULL for the head     */
+};
+
+static int64_t now_realtime(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static inline segment_header_t * header(journal_segment_t * segment) {
+	return (segment_header_t *)segment->base;
+}
+
+static void segment_path(journal_t * journal, uint64_t first, char * path, size_t size) {
+	snprintf(path, size, "%s/%020" PRIu64 ".seg", journal->dir, first);
+}
+
+static inline size_t segment_size(journal_t * journal) {
+	return SEGMENT_HEADER + (size_t)journal->segment_records * journal->record_size;
+}
+
+static inline bool in_segment(journal_t * journal, journal_segment_t * segment,
+                              uint64_t seq) {
+	return seq >= segment->first && seq - segment->first < journal->segment_records;
+}
+
+static inline _Atomic uint64_t * commit(journal_t * journal, journal_segment_t * segment,
+                                       uint64_t seq) {
+	return (_Atomic uint64_t *)(segment->base + SEGMENT_HEADER
+	                            + (seq - segment->first) * journal->record_size);
+}
+
+static inline void * payload(journal_t * journal, journal_segment_t * segment,
+                             uint64_t seq) {
+	return (uint8_t *)commit(journal, segment, seq) + RECORD_HEADER;
+}
+
+// Maps a segment file, creating it if create is true. NULL on error.
+static journal_segment_t * map_segment(journal_t * journal, uint64_t first, bool create) {
+	char path[PATH_MAX];
+	segment_path(journal, first, path, sizeof(path));
+	int fd = open(path, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0644);
+	if (fd < 0)
+		return NULL;
+
+	size_t size = segment_size(journal);
+	void * base = MAP_FAILED;
+	if (!create || ftruncate(fd, size) == 0)
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int error = errno;
+	close(fd);
+	if (base == MAP_FAILED) {
+		if (create)
+			unlink(path);
+		errno = error;
+		return NULL;
+	}
+
+	journal_segment_t * segment = (journal_segment_t *)malloc(sizeof(journal_segment_t));
+	segment->first = first;
+	segment->base = (uint8_t *)base;
+	segment->size = size;
+	atomic_init(&segment->refs, 0);
+	atomic_init(&segment->next, NULL);
+
+	segment_header_t * h = header(segment);
+	if (create) {
+		h->first = first;
+		h->record_size = journal->record_size;
+		h->records = journal->segment_records;
+		h->created = now_realtime();
+		h->magic = JOURNAL_MAGIC;
+	} else if (h->magic != JOURNAL_MAGIC || h->first != first
+	           || h->record_size != journal->record_size
+	           || h->records != journal->segment_records) {
+		munmap(base, size);
+		free(segment);
+		errno = EINVAL;
+		return NULL;
+	}
+	return segment;
+}
+
+static void remove_segment(journal_t * journal, journal_segment_t * segment) {
+	char path[PATH_MAX];
+	segment_path(journal, segment->first, path, sizeof(path));
+	munmap(segment->base, segment->size);
+	unlink(path);
+	free(segment);
+}
+
+// True if no producer is still writing a record of the segment
+static bool all_published(journal_t * journal, journal_segment_t * segment) {
+	for (uint64_t seq=segment->first; seq<segment->first + journal->segment_records; seq++) {
+		if (atomic_load_explicit(commit(journal, segment, seq), memory_order_acquire)
+		    != seq + 1)
+			return false;
+	}
+	return true;
+}
+
+// Removes the oldest segments while they are past retention, stopping at the first
+// one a reader or producer still uses. Called with the mutex locked.
+static void apply_retention(journal_t * journal) {
+	journal_segment_t * head = atomic_load(&journal->head);
+	int64_t now = now_realtime();
+	while (journal->oldest != head) {
+		journal_segment_t * segment = journal->oldest;
+		journal_segment_t * next = atomic_load(&segment->next);
+		// Its records are all older than the next segment
+		bool expired = (journal->retention_bytes && journal->size > journal->retention_bytes)
+		               || (journal->retention_secs && now - header(next)->created
+		                   > (int64_t)journal->retention_secs * 1000000000);
+		if (!expired || atomic_load(&segment->refs) || !all_published(journal, segment))
+			return;
+
+		journal->oldest = next;
+		journal->size -= segment->size;
+		remove_segment(journal, segment);
+	}
+}
+
+// Adds a segment after the head. Called with the mutex locked.
+static journal_segment_t * append_segment(journal_t * journal) {
+	journal_segment_t * head = atomic_load(&journal->head);
+	uint64_t first = head ? head->first + journal->segment_records : 0;
+	journal_segment_t * segment = map_segment(journal, first, true);
+	if (!segment)
+		return NULL;
+
+	journal->size += segment->size;
+	if (head)
+		atomic_store(&head->next, segment);
+	else
+		journal->oldest = segment;
+	atomic_store(&journal->head, segment);
+	atomic_store_explicit(&journal->end, first + journal->segment_records,
+	                      memory_order_release);
+	apply_retention(journal);
+	return segment;
+}
+
+static int compare_seq(const void * a, const void * b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Maps the existing segments and finds where the log ends
+static int recover(journal_t * journal) {
+	DIR * d = opendir(journal->dir);
+	if (!d)
+		return -1;
+
+	uint64_t * firsts = NULL;
+	size_t count = 0, capacity = 0;
+	struct dirent * e;
+	while ((e = readdir(d))) {
+		uint64_t first;
+		char suffix[8];
+		if (sscanf(e->d_name, "%" SCNu64 ".%7s", &first, suffix) != 2 || strcmp(suffix, "seg"))
+			continue;
+		if (count == capacity) {
+			capacity = capacity ? 2 * capacity : 16;
+			firsts = (uint64_t *)realloc(firsts, capacity * sizeof(uint64_t));
+		}
+		firsts[count++] = first;
+	}
+	closedir(d);
+	qsort(firsts, count, sizeof(uint64_t), compare_seq);
+
+	for (size_t i=0; i<count; i++) {
+		journal_segment_t * segment = map_segment(journal, firsts[i], false);
+		if (!segment) {
+			free(firsts);
+			return -1;
+		}
+		journal->size += segment->size;
+		journal_segment_t * head = atomic_load(&journal->head);
+		if (head)
+			atomic_store(&head->next, segment);
+		else
+			journal->oldest = segment;
+		atomic_store(&journal->head, segment);
+	}
+	free(firsts);
+
+	if (!journal->oldest)
+		return append_segment(journal) ? 0 : -1;
+
+	// The log ends at the first record not published, in whichever retained
+	// segment a producer crashed between claim and publish (or at a missing
+	// segment file). Records after it were published out of order before the
+	// crash: they are claimed again, and the newer segments are dropped.
+	journal_segment_t * segment = journal->oldest;
+	uint64_t seq = segment->first;
+	for (;;) {
+		while (in_segment(journal, segment, seq)
+		       && atomic_load(commit(journal, segment, seq)) == seq + 1)
+			seq++;
+		journal_segment_t * next = atomic_load(&segment->next);
+		if (in_segment(journal, segment, seq) || !next || next->first != seq)
+			break;
+		segment = next;
+	}
+
+	journal_segment_t * next = atomic_load(&segment->next);
+	while (next) {
+		journal_segment_t * after = atomic_load(&next->next);
+		journal->size -= next->size;
+		remove_segment(journal, next);
+		next = after;
+	}
+	atomic_store(&segment->next, NULL);
+	atomic_store(&journal->head, segment);
+	atomic_store(&journal->end, segment->first + journal->segment_records);
+
+	atomic_store(&journal->write, seq);
+	for (uint64_t s=seq; in_segment(journal, segment, s); s++)
+		atomic_store(commit(journal, segment, s), 0);
+	return 0;
+}
+
+int journal_open(journal_t * journal, const journal_config_t * config) {
+	if (mkdir(config->dir, 0755) < 0 && errno != EEXIST)
+		return -1;
+
+	journal->dir = strdup(config->dir);
+	size_t align = _Alignof(max_align_t) > RECORD_HEADER ? _Alignof(max_align_t) : RECORD_HEADER;
+	journal->record_size = RECORD_HEADER + (config->record_size + align - 1) / align * align;
+	journal->segment_records = config->segment_records ? config->segment_records
+	                                                   : JOURNAL_SEGMENT_RECORDS;
+	journal->retention_bytes = config->retention_bytes;
+	journal->retention_secs = config->retention_secs;
+	atomic_init(&journal->write, 0);
+	atomic_init(&journal->end, 0);
+	atomic_init(&journal->head, NULL);
+	journal->oldest = NULL;
+	journal->size = 0;
+	pthread_mutex_init(&journal->mutex, NULL);
+	fifo_wait_init(&journal->wait);
+
+	if (recover(journal) < 0) {
+		int error = errno;
+		journal_close(journal);
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+// Segment of a claimed sequence. journal_claim added it before taking the sequence.
+static journal_segment_t * claimed_segment(journal_t * journal, uint64_t seq) {
+	journal_segment_t * segment = atomic_load(&journal->head);
+	if (in_segment(journal, segment, seq))
+		return segment;
+
+	pthread_mutex_lock(&journal->mutex);
+	// Behind the head if other producers appended meanwhile. Retention doesn't
+	// remove it while this record is not published.
+	for (segment = journal->oldest; !in_segment(journal, segment, seq);
+	     segment = atomic_load(&segment->next));
+	pthread_mutex_unlock(&journal->mutex);
+	return segment;
+}
+
+void * journal_claim(journal_t * journal, uint64_t * seq) {
+	// Only take a sequence a segment already has room for: one taken and never
+	// published would block the readers and retention for good
+	uint64_t write = atomic_load_explicit(&journal->write, memory_order_relaxed);
+	for (;;) {
+		if (write < atomic_load_explicit(&journal->end, memory_order_acquire)) {
+			if (atomic_compare_exchange_weak_explicit(&journal->write, &write, write + 1,
+			                                          memory_order_relaxed,
+			                                          memory_order_relaxed))
+				break;
+			continue;
+		}
+		pthread_mutex_lock(&journal->mutex);
+		journal_segment_t * segment = NULL;
+		if (atomic_load(&journal->end) <= write)
+			segment = append_segment(journal);
+		pthread_mutex_unlock(&journal->mutex);
+		if (!segment && atomic_load(&journal->end) <= write)
+			return NULL;
+		write = atomic_load_explicit(&journal->write, memory_order_relaxed);
+	}
+	*seq = write;
+	return payload(journal, claimed_segment(journal, write), write);
+}
+
+void journal_publish(journal_t * journal, uint64_t seq) {
+	journal_segment_t * segment = claimed_segment(journal, seq);
+	atomic_store_explicit(commit(journal, segment, seq), seq + 1, memory_order_release);
+	fifo_wait_wake(&journal->wait);
+}
+
+uint64_t journal_first(journal_t * journal) {
+	pthread_mutex_lock(&journal->mutex);
+	uint64_t first = journal->oldest->first;
+	pthread_mutex_unlock(&journal->mutex);
+	return first;
+}
+
+uint64_t journal_next(journal_t * journal) {
+	return atomic_load(&journal->write);
+}
+
+int journal_sync(journal_t * journal) {
+	int ret = 0;
+	pthread_mutex_lock(&journal->mutex);
+	for (journal_segment_t * s = journal->oldest; s; s = atomic_load(&s->next)) {
+		if (msync(s->base, s->size, MS_SYNC) < 0)
+			ret = -1;
+	}
+	pthread_mutex_unlock(&journal->mutex);
+	return ret;
+}
+
+int journal_reader_init(journal_reader_t * reader, journal_t * journal, uint64_t seq) {
+	pthread_mutex_lock(&journal->mutex);
+	journal_segment_t * segment = journal->oldest;
+	if (seq < segment->first || seq > atomic_load(&journal->write)) {
+		pthread_mutex_unlock(&journal->mutex);
+		errno = ERANGE;
+		return -1;
+	}
+	// The head if seq starts a segment not appended yet
+	while (!in_segment(journal, segment, seq) && atomic_load(&segment->next))
+		segment = atomic_load(&segment->next);
+	atomic_fetch_add(&segment->refs, 1);
+	pthread_mutex_unlock(&journal->mutex);
+
+	reader->journal = journal;
+	reader->segment = segment;
+	reader->seq = seq;
+	return 0;
+}
+
+const void * journal_try_read(journal_reader_t * reader) {
+	journal_t * journal = reader->journal;
+	journal_segment_t * segment = reader->segment;
+	if (!in_segment(journal, segment, reader->seq)) {
+		// Hold the next segment before letting retention remove this one
+		journal_segment_t * next = atomic_load(&segment->next);
+		if (!next)
+			return NULL;
+		atomic_fetch_add(&next->refs, 1);
+		atomic_fetch_sub(&segment->refs, 1);
+		reader->segment = segment = next;
+	}
+
+	uint64_t seq = reader->seq;
+	if (atomic_load_explicit(commit(journal, segment, seq), memory_order_acquire) != seq + 1)
+		return NULL;
+	return payload(journal, segment, seq);
+}
+
+// Condition of journal_read: the next record is published
+typedef struct {
+	journal_reader_t * reader;
+	const void * record;
+} journal_poll_t;
+
+static bool readable(void * p) {
+	journal_poll_t * poll = (journal_poll_t *)p;
+	return (poll->record = journal_try_read(poll->reader)) != NULL;
+}
+
+const void * journal_read(journal_reader_t * reader) {
+	journal_poll_t poll = { reader, NULL };
+	fifo_wait_until(&reader->journal->wait, SPIN_POLLS, readable, &poll, NULL);
+	return poll.record;
+}
+
+void journal_release(journal_reader_t * reader) {
+	reader->seq++;
+}
+
+void journal_reader_destroy(journal_reader_t * reader) {
+	atomic_fetch_sub(&reader->segment->refs, 1);
+}
+
+void journal_close(journal_t * journal) {
+	journal_sync(journal);
+	journal_segment_t * segment = journal->oldest;
+	while (segment) {
+		journal_segment_t * next = atomic_load(&segment->next);
+		munmap(segment->base, segment->size);
+		free(segment);
+		segment = next;
+	}
+	fifo_wait_destroy(&journal->wait);
+	pthread_mutex_destroy(&journal->mutex);
+	free(journal->dir);
+}
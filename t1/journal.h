@@ -0,0 +1,172 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "fifo.h"
+
+/**
+ * @defgroup journal Journal
+ * @brief Persistent record FIFO: a log of fixed size records appended to
+ *        memory mapped segment files in a directory. The FIFO is a window over the
+ *        log, from the oldest retained record to the newest. Producers never wait
+ *        for readers. Readers start at any retained sequence, so a new or restarted
+ *        consumer catches up by reading the mapped records in place.
+ *        Old segments are removed by size or age (retention), except the ones
+ *        readers are still reading.
+ *        Multiple producers and readers (threads of one process). Reopening the
+ *        directory recovers the log up to the last record published in order.
+ * @{
+ */
+
+typedef struct journal_segment journal_segment_t;
+
+/**
+ * @brief Journal options. Zero initialized fields take the default.
+ */
+typedef struct {
+	const char * dir;               /**< Directory of the segment files (created) */
+	size_t record_size;             /**< Record size in bytes                    */
+	uint32_t segment_records;       /**< Records per segment file (default 4096) */
+	uint64_t retention_bytes;       /**< Keep at most this size of segments, 0 for
+	                                     no limit                                  */
+	uint32_t retention_secs;        /**< Remove segments with records all older
+	                                     than this, 0 for no limit                */
+} journal_config_t;
+
+/**
+ * @brief Journal instance
+ */
+typedef struct {
+	char * dir;                     /**< Segment files directory                 */
+	size_t record_size;             /**< Record size in the file (aligned, with its
+	                                     sequence)                                 */
+	uint32_t segment_records;       /**< Records per segment                     */
+	uint64_t retention_bytes;       /**< Size retention, 0 if none               */
+	uint32_t retention_secs;        /**< Age retention, 0 if none                */
+	_Atomic uint64_t write;         /**< Next sequence to be claimed             */
+	_Atomic uint64_t end;           /**< Sequence after the head segment: claims
+	                                     stay below it                             */
+	_Atomic(journal_segment_t *) head; /**< Newest segment                       */
+	pthread_mutex_t mutex;          /**< Protects the segment list below         */
+	journal_segment_t * oldest;     /**< Oldest retained segment                 */
+	uint64_t size;                  /**< Size of all segments                    */
+	fifo_wait_t wait;               /**< Readers waiting for records             */
+} journal_t;
+
+/**
+ * @brief Position of one consumer in the journal
+ */
+typedef struct {
+	journal_t * journal;
+	journal_segment_t * segment;    /**< Segment of seq                          */
+	uint64_t seq;                   /**< Next sequence to read                   */
+} journal_reader_t;
+
+/**
+ * @brief Opens the journal in config->dir, creating it if needed. An existing
+ *        journal must have been created with the same record size.
+ *
+ * @param[out] journal The journal instance
+ * @param[in] config Options
+ * @return 0, or -1 on error (see errno)
+ */
+int journal_open(journal_t * journal, const journal_config_t * config);
+
+/**
+ * @brief Claims the next record, appending a segment if needed. Never waits for
+ *        readers. The record must be written and then published with
+ *        journal_publish. If the segment can't be added no sequence is taken, so
+ *        readers are not left waiting on a record never published.
+ *
+ * @param[in] journal The journal instance
+ * @param[out] seq Sequence of the claimed record, to pass to journal_publish
+ * @return Pointer to the record inside the segment, NULL on error (see errno)
+ */
+void * journal_claim(journal_t * journal, uint64_t * seq);
+
+/**
+ * @brief Makes a record claimed with journal_claim visible to the readers
+ *
+ * @param[in] journal The journal instance
+ * @param[in] seq Sequence returned by journal_claim
+ */
+void journal_publish(journal_t * journal, uint64_t seq);
+
+/**
+ * @brief Oldest retained sequence
+ *
+ * @param[in] journal The journal instance
+ * @return The sequence
+ */
+uint64_t journal_first(journal_t * journal);
+
+/**
+ * @brief Next sequence to be claimed
+ *
+ * @param[in] journal The journal instance
+ * @return The sequence
+ */
+uint64_t journal_next(journal_t * journal);
+
+/**
+ * @brief Writes the published records to the files
+ *
+ * @param[in] journal The journal instance
+ * @return 0, or -1 on error (see errno)
+ */
+int journal_sync(journal_t * journal);
+
+/**
+ * @brief Starts a reader at @p seq. Segments from the one of @p seq on are retained
+ *        until the reader moves past them.
+ *
+ * @param[out] reader The reader instance
+ * @param[in] journal The journal instance
+ * @param[in] seq First sequence to read, from journal_first to journal_next
+ * @return 0, or -1 with errno ERANGE if @p seq is not retained
+ */
+int journal_reader_init(journal_reader_t * reader, journal_t * journal, uint64_t seq);
+
+/**
+ * @brief Returns the next record of the reader, blocking if it wasn't published.
+ *        The record stays valid until journal_release is called.
+ *
+ * @param[in] reader The reader instance
+ * @return Pointer to the record inside the segment
+ */
+const void * journal_read(journal_reader_t * reader);
+
+/**
+ * @brief Like journal_read, but never blocks
+ *
+ * @param[in] reader The reader instance
+ * @return Pointer to the record inside the segment, NULL if there is none
+ */
+const void * journal_try_read(journal_reader_t * reader);
+
+/**
+ * @brief Moves the reader past the record returned by journal_read
+ *
+ * @param[in] reader The reader instance
+ */
+void journal_release(journal_reader_t * reader);
+
+/**
+ * @brief Stops the reader, so it no longer holds segments back
+ *
+ * @param[in] reader The reader instance
+ */
+void journal_reader_destroy(journal_reader_t * reader);
+
+/**
+ * @brief Writes the records to the files and closes the journal. The readers must
+ *        be destroyed first.
+ *
+ * @param[in] journal The journal instance
+ */
+void journal_close(journal_t * journal);
+
+/** @} */
@@ -0,0 +1,538 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "logger.h"
+
+#define LOGGER_LINE     1024        // Longest line written, longer ones are truncated
+#define LOGGER_OUT      (64 * 1024) // Output batch size
+#define LOGGER_INTERVAL 10          // ms the background thread sleeps when idle
+
+typedef union {
+	intmax_t i;
+	uintmax_t u;                    // Also the offset of a string in text
+	double f;
+	const void * p;
+} logger_arg_t;
+
+typedef struct {
+	const char * format;
+	uint64_t dropped;               // Lines the thread dropped just before this one
+	uint32_t count;                 // Arguments captured
+	logger_arg_t args[LOGGER_ARGS];
+	char text[LOGGER_TEXT];         // String arguments
+} logger_record_t;
+
+// Ring of one thread. The thread writes head, the background thread writes tail.
+struct logger_buffer {
+	logger_buffer_t * next;
+	atomic_bool closed;             // The thread exited
+	_Alignas(64) _Atomic uint64_t head;
+	_Atomic uint64_t dropped;       // Lines dropped since the last record. Taken
+	                                // by the next record, or by the background
+	                                // thread once closed or stopping
+	_Alignas(64) _Atomic uint64_t tail;
+	logger_record_t records[];
+};
+
+typedef enum {
+	MOD_NONE, MOD_HH, MOD_H, MOD_L, MOD_LL, MOD_J, MOD_Z, MOD_T
+} logger_mod_t;
+
+// One conversion of a format
+typedef struct {
+	const char * start;             // The '%'
+	size_t prefix;                  // Length of '%', flags, width and precision
+	logger_mod_t mod;
+	char conv;                      // Conversion, '\0' at the end of the format
+} logger_spec_t;
+
+// Output batch of the background thread
+typedef struct {
+	int fd;
+	char * data;
+	size_t len;
+} logger_out_t;
+
+// Open loggers, flushed at exit
+typedef struct logger_node {
+	logger_t * logger;
+	struct logger_node * next;
+} logger_node_t;
+
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t open_mutex = PTHREAD_MUTEX_INITIALIZER;
+static logger_node_t * open_loggers;
+
+// Parses the conversion starting after the '%' at f. Returns the end of it.
+static const char * parse_spec(const char * f, logger_spec_t * spec) {
+	spec->start = f - 1;
+	while (*f && strchr("-+ #0", *f))
+		f++;
+	while (isdigit((unsigned char)*f))
+		f++;
+	if (*f == '.') {
+		f++;
+		while (isdigit((unsigned char)*f))
+			f++;
+	}
+	spec->prefix = f - spec->start;
+
+	spec->mod = MOD_NONE;
+	if (f[0] == 'h' && f[1] == 'h')
+		spec->mod = MOD_HH, f += 2;
+	else if (f[0] == 'l' && f[1] == 'l')
+		spec->mod = MOD_LL, f += 2;
+	else if (*f == 'h')
+		spec->mod = MOD_H, f++;
+	else if (*f == 'l')
+		spec->mod = MOD_L, f++;
+	else if (*f == 'j')
+		spec->mod = MOD_J, f++;
+	else if (*f == 'z')
+		spec->mod = MOD_Z, f++;
+	else if (*f == 't')
+		spec->mod = MOD_T, f++;
+
+	spec->conv = *f;
+	return *f ? f + 1 : f;
+}
+
+static intmax_t signed_arg(logger_mod_t mod, va_list * ap) {
+	switch (mod) {
+	case MOD_HH: return (signed char)va_arg(*ap, int);
+	case MOD_H:  return (short)va_arg(*ap, int);
+	case MOD_L:  return va_arg(*ap, long);
+	case MOD_LL: return va_arg(*ap, long long);
+	case MOD_J:  return va_arg(*ap, intmax_t);
+	case MOD_Z:
+	case MOD_T:  return va_arg(*ap, ptrdiff_t);
+	default:     return va_arg(*ap, int);
+	}
+}
+
+static uintmax_t unsigned_arg(logger_mod_t mod, va_list * ap) {
+	switch (mod) {
+	case MOD_HH: return (unsigned char)va_arg(*ap, unsigned);
+	case MOD_H:  return (unsigned short)va_arg(*ap, unsigned);
+	case MOD_L:  return va_arg(*ap, unsigned long);
+	case MOD_LL: return va_arg(*ap, unsigned long long);
+	case MOD_J:  return va_arg(*ap, uintmax_t);
+	case MOD_Z:
+	case MOD_T:  return va_arg(*ap, size_t);
+	default:     return va_arg(*ap, unsigned);
+	}
+}
+
+// Copies the arguments of format to the record. Stops at the first conversion
+// it doesn't support, and so does render.
+static void capture(logger_record_t * r, const char * f, va_list * ap) {
+	uint32_t count = 0;
+	size_t text = 0;
+	while ((f = strchr(f, '%')) && count < LOGGER_ARGS) {
+		logger_spec_t spec;
+		f = parse_spec(f + 1, &spec);
+		if (spec.conv == '%')
+			continue;
+
+		logger_arg_t * a = &r->args[count];
+		switch (spec.conv) {
+		case 'd': case 'i':
+			a->i = signed_arg(spec.mod, ap);
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			a->u = unsigned_arg(spec.mod, ap);
+			break;
+		case 'c':
+			a->i = va_arg(*ap, int);
+			break;
+		case 'p':
+			a->p = va_arg(*ap, void *);
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			a->f = va_arg(*ap, double);
+			break;
+		case 's': {
+			// Truncated to the room left, which always has the terminator
+			const char * s = va_arg(*ap, const char *);
+			if (!s)
+				s = "(null)";
+			size_t n = strnlen(s, LOGGER_TEXT - 1 - text);
+			memcpy(r->text + text, s, n);
+			r->text[text + n] = '\0';
+			a->u = text;
+			text += n + 1;
+			if (text > LOGGER_TEXT - 1)
+				text = LOGGER_TEXT - 1;
+			break;
+		}
+		default:
+			r->count = count;
+			return;
+		}
+		count++;
+	}
+	r->count = count;
+}
+
+// Appends up to n bytes of s, leaving room for the terminator
+static void append(char * out, size_t size, size_t * len, const char * s, size_t n) {
+	if (n > size - 1 - *len)
+		n = size - 1 - *len;
+	memcpy(out + *len, s, n);
+	*len += n;
+}
+
+// Formats a record into out. Returns the length, at most size - 1.
+static size_t render(const logger_record_t * r, char * out, size_t size) {
+	size_t len = 0;
+	uint32_t arg = 0;
+	const char * f = r->format;
+	while (*f) {
+		const char * percent = strchr(f, '%');
+		append(out, size, &len, f, percent ? (size_t)(percent - f) : strlen(f));
+		if (!percent)
+			break;
+
+		logger_spec_t spec;
+		f = parse_spec(percent + 1, &spec);
+		if (spec.conv == '%') {
+			append(out, size, &len, "%", 1);
+			continue;
+		}
+		if (arg == r->count)
+			continue;
+
+		// The flags, width and precision of the format, with the argument type
+		char format[40];
+		size_t prefix = spec.prefix < 30 ? spec.prefix : 30;
+		memcpy(format, spec.start, prefix);
+		const logger_arg_t * a = &r->args[arg++];
+		int n;
+		switch (spec.conv) {
+		case 'd': case 'i':
+			snprintf(format + prefix, 10, "j%c", spec.conv);
+			n = snprintf(out + len, size - len, format, a->i);
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			snprintf(format + prefix, 10, "j%c", spec.conv);
+			n = snprintf(out + len, size - len, format, a->u);
+			break;
+		case 'c':
+			snprintf(format + prefix, 10, "c");
+			n = snprintf(out + len, size - len, format, (int)a->i);
+			break;
+		case 'p':
+			snprintf(format + prefix, 10, "p");
+			n = snprintf(out + len, size - len, format, a->p);
+			break;
+		case 's':
+			snprintf(format + prefix, 10, "s");
+			n = snprintf(out + len, size - len, format, r->text + a->u);
+			break;
+		default:
+			snprintf(format + prefix, 10, "%c", spec.conv);
+			n = snprintf(out + len, size - len, format, a->f);
+			break;
+		}
+		if (n > 0)
+			len = len + n < size - 1 ? len + n : size - 1;
+	}
+	return len;
+}
+
+static void write_all(int fd, const char * data, size_t len) {
+	while (len) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+static void out_flush(logger_out_t * out) {
+	write_all(out->fd, out->data, out->len);
+	out->len = 0;
+}
+
+// Makes room for one more line
+static char * out_line(logger_out_t * out) {
+	if (LOGGER_OUT - out->len < LOGGER_LINE)
+		out_flush(out);
+	return out->data + out->len;
+}
+
+static void out_dropped(logger_out_t * out, uint64_t dropped) {
+	out->len += snprintf(out_line(out), LOGGER_LINE, "[%llu lines dropped]\n",
+	                     (unsigned long long)dropped);
+}
+
+static void buffer_release(void * p) {
+	logger_buffer_t * b = (logger_buffer_t *)p;
+	atomic_store_explicit(&b->closed, true, memory_order_release);
+}
+
+static logger_buffer_t * thread_buffer(logger_t * logger) {
+	logger_buffer_t * b = (logger_buffer_t *)pthread_getspecific(logger->key);
+	if (b)
+		return b;
+
+	size_t size = sizeof(logger_buffer_t) + logger->records * sizeof(logger_record_t);
+	b = (logger_buffer_t *)aligned_alloc(64, (size + 63) / 64 * 64);
+	if (!b)
+		return NULL;
+	atomic_init(&b->closed, false);
+	atomic_init(&b->head, 0);
+	atomic_init(&b->dropped, 0);
+	atomic_init(&b->tail, 0);
+	pthread_mutex_lock(&logger->mutex);
+	b->next = logger->buffers;
+	logger->buffers = b;
+	pthread_mutex_unlock(&logger->mutex);
+	pthread_setspecific(logger->key, b);
+	return b;
+}
+
+// Frees the buffers of exited threads that were written out
+static void reap(logger_t * logger) {
+	pthread_mutex_lock(&logger->mutex);
+	for (logger_buffer_t ** p = &logger->buffers; *p; ) {
+		logger_buffer_t * b = *p;
+		if (atomic_load_explicit(&b->closed, memory_order_acquire)
+		    && atomic_load(&b->tail) == atomic_load(&b->head)) {
+			*p = b->next;
+			free(b);
+		} else {
+			p = &b->next;
+		}
+	}
+	pthread_mutex_unlock(&logger->mutex);
+}
+
+// Formats and writes every record in the buffers. On the last pass, also reports
+// lines dropped by threads that didn't log again. Returns true if there were any.
+static bool drain(logger_t * logger, logger_out_t * out, bool last) {
+	// Only the background thread removes buffers, and new ones are added at the
+	// head, so the list can be walked without the mutex
+	pthread_mutex_lock(&logger->mutex);
+	logger_buffer_t * b = logger->buffers;
+	pthread_mutex_unlock(&logger->mutex);
+
+	bool any = false;
+	bool exited = false;
+	for (; b; b = b->next) {
+		// Once closed, head doesn't move anymore
+		bool closed = atomic_load_explicit(&b->closed, memory_order_acquire);
+		uint64_t head = atomic_load_explicit(&b->head, memory_order_acquire);
+		uint64_t tail = atomic_load_explicit(&b->tail, memory_order_relaxed);
+		for (; tail < head; tail++) {
+			const logger_record_t * r = &b->records[tail % logger->records];
+			if (r->dropped)
+				out_dropped(out, r->dropped);
+			out->len += render(r, out_line(out), LOGGER_LINE);
+			atomic_store_explicit(&b->tail, tail + 1, memory_order_release);
+			any = true;
+		}
+
+		// Taken with an exchange: the thread may still be logging on the last pass,
+		// and its next record then reports only what was dropped after this
+		if ((closed || last) && atomic_load_explicit(&b->dropped, memory_order_relaxed)) {
+			uint64_t dropped = atomic_exchange_explicit(&b->dropped, 0,
+			                                            memory_order_relaxed);
+			if (dropped)
+				out_dropped(out, dropped);
+		}
+		exited |= closed;
+	}
+	out_flush(out);
+
+	if (exited)
+		reap(logger);
+	return any;
+}
+
+// Parks until woken or LOGGER_INTERVAL passes
+static void park(logger_t * logger) {
+	fifo_wait_t * w = &logger->wait;
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_nsec += LOGGER_INTERVAL * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&w->mutex);
+	// seq_cst increment and loads: a thread that sets stop or requests a flush
+	// and then calls fifo_wait_wake either sees the waiter or is seen here. No
+	// fence, so the logger can be checked with -fsanitize=thread.
+	atomic_fetch_add_explicit(&w->waiters, 1, memory_order_seq_cst);
+	if (!atomic_load(&logger->stop)
+	    && atomic_load(&logger->flush_requests) == atomic_load(&logger->flushed))
+		pthread_cond_timedwait(&w->cond, &w->mutex, &deadline);
+	atomic_fetch_sub(&w->waiters, 1);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+static void * writer(void * p) {
+	logger_t * logger = (logger_t *)p;
+	logger_out_t out = { logger->fd, (char *)malloc(LOGGER_OUT), 0 };
+	for (;;) {
+		// Read before draining: what was logged before them is drained below
+		bool stop = atomic_load(&logger->stop);
+		uint64_t requests = atomic_load(&logger->flush_requests);
+		bool any = drain(logger, &out, stop);
+
+		if (requests != atomic_load(&logger->flushed)) {
+			atomic_store(&logger->flushed, requests);
+			fifo_wait_wake(&logger->flush_wait);
+		}
+		if (stop)
+			break;
+		if (!any)
+			park(logger);
+	}
+	free(out.data);
+	return NULL;
+}
+
+static void flush_at_exit(void) {
+	pthread_mutex_lock(&open_mutex);
+	for (logger_node_t * n = open_loggers; n; n = n->next)
+		logger_flush(n->logger);
+	pthread_mutex_unlock(&open_mutex);
+}
+
+static void register_exit(void) {
+	atexit(flush_at_exit);
+}
+
+int logger_init(logger_t * logger, int fd, uint32_t records) {
+	logger_node_t * node = (logger_node_t *)malloc(sizeof(logger_node_t));
+	if (!node)
+		return -1;
+
+	logger->fd = fd;
+	logger->records = records ? records : LOGGER_RECORDS;
+	pthread_mutex_init(&logger->mutex, NULL);
+	logger->buffers = NULL;
+	pthread_key_create(&logger->key, buffer_release);
+	atomic_init(&logger->stop, false);
+	atomic_init(&logger->flush_requests, 0);
+	atomic_init(&logger->flushed, 0);
+	atomic_init(&logger->dropped, 0);
+	fifo_wait_init(&logger->wait);
+	fifo_wait_init(&logger->flush_wait);
+
+	int error = pthread_create(&logger->thread, NULL, writer, logger);
+	if (error) {
+		fifo_wait_destroy(&logger->wait);
+		fifo_wait_destroy(&logger->flush_wait);
+		pthread_key_delete(logger->key);
+		pthread_mutex_destroy(&logger->mutex);
+		free(node);
+		errno = error;
+		return -1;
+	}
+
+	pthread_once(&exit_once, register_exit);
+	node->logger = logger;
+	pthread_mutex_lock(&open_mutex);
+	node->next = open_loggers;
+	open_loggers = node;
+	pthread_mutex_unlock(&open_mutex);
+	return 0;
+}
+
+bool logger_printf(logger_t * logger, const char * format, ...) {
+	logger_buffer_t * b = thread_buffer(logger);
+	if (!b) {
+		atomic_fetch_add_explicit(&logger->dropped, 1, memory_order_relaxed);
+		return false;
+	}
+
+	uint64_t head = atomic_load_explicit(&b->head, memory_order_relaxed);
+	uint64_t tail = atomic_load_explicit(&b->tail, memory_order_acquire);
+	if (head - tail == logger->records) {
+		atomic_fetch_add_explicit(&b->dropped, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&logger->dropped, 1, memory_order_relaxed);
+		return false;
+	}
+
+	logger_record_t * r = &b->records[head % logger->records];
+	r->format = format;
+	// Exchanged only when set: the background thread may take it on its last pass
+	r->dropped = atomic_load_explicit(&b->dropped, memory_order_relaxed);
+	if (r->dropped)
+		r->dropped = atomic_exchange_explicit(&b->dropped, 0, memory_order_relaxed);
+	va_list ap;
+	va_start(ap, format);
+	capture(r, format, &ap);
+	va_end(ap);
+	atomic_store_explicit(&b->head, head + 1, memory_order_release);
+
+	// Don't wait for the background thread to wake up by itself if the buffer is
+	// filling up
+	if (head + 1 - tail == (logger->records + 1) / 2)
+		fifo_wait_wake(&logger->wait);
+	return true;
+}
+
+// Condition of logger_flush: the background thread got to the request
+typedef struct {
+	logger_t * logger;
+	uint64_t request;
+} logger_poll_t;
+
+static bool flush_done(void * p) {
+	logger_poll_t * poll = (logger_poll_t *)p;
+	return atomic_load(&poll->logger->flushed) >= poll->request;
+}
+
+void logger_flush(logger_t * logger) {
+	logger_poll_t poll = { logger, atomic_fetch_add(&logger->flush_requests, 1) + 1 };
+	fifo_wait_wake(&logger->wait);
+	// The background thread writes to a file: don't spin
+	fifo_wait_until(&logger->flush_wait, 0, flush_done, &poll, NULL);
+}
+
+uint64_t logger_dropped(logger_t * logger) {
+	return atomic_load_explicit(&logger->dropped, memory_order_relaxed);
+}
+
+void logger_destroy(logger_t * logger) {
+	pthread_mutex_lock(&open_mutex);
+	for (logger_node_t ** p = &open_loggers; *p; p = &(*p)->next) {
+		if ((*p)->logger == logger) {
+			logger_node_t * node = *p;
+			*p = node->next;
+			free(node);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&open_mutex);
+
+	atomic_store(&logger->stop, true);
+	fifo_wait_wake(&logger->wait);
+	pthread_join(logger->thread, NULL);
+
+	pthread_key_delete(logger->key);
+	while (logger->buffers) {
+		logger_buffer_t * next = logger->buffers->next;
+		free(logger->buffers);
+		logger->buffers = next;
+	}
+	fifo_wait_destroy(&logger->wait);
+	fifo_wait_destroy(&logger->flush_wait);
+	pthread_mutex_destroy(&logger->mutex);
+}
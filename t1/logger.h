@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "fifo.h"
+
+/**
+ * @defgroup logger Logger
+ * @brief Asynchronous printf-style logging. A logging thread only copies the format
+ *        pointer and the arguments to a fixed size record in its own buffer (a
+ *        lock-free ring with one writer and one reader). A background thread formats
+ *        the records and writes them to the file descriptor in large batches.
+ *        The lines of each thread are written in the order it logged them. Lines of
+ *        different threads may interleave in any order.
+ *        Memory is bounded: when the buffer of a thread is full, its records are
+ *        dropped and counted, and the next line it writes says how many were lost.
+ *        Open loggers are flushed at exit (atexit), and by logger_destroy.
+ * @{
+ */
+
+#define LOGGER_RECORDS 1024   /**< Default buffer size of each thread, in records   */
+#define LOGGER_ARGS    8      /**< Maximum arguments of one record                  */
+#define LOGGER_TEXT    96     /**< Room for the string arguments of one record      */
+
+typedef struct logger_buffer logger_buffer_t;
+
+/**
+ * @brief Logger instance
+ */
+typedef struct {
+	int fd;                         /**< Where the lines are written             */
+	uint32_t records;               /**< Buffer size of each thread              */
+	pthread_mutex_t mutex;          /**< Protects buffers                        */
+	logger_buffer_t * buffers;      /**< Buffers of the threads that logged      */
+	pthread_key_t key;              /**< Buffer of the calling thread            */
+	pthread_t thread;               /**< Background thread                       */
+	atomic_bool stop;               /**< Set by logger_destroy                   */
+	_Atomic uint64_t flush_requests; /**< Number of logger_flush calls           */
+	_Atomic uint64_t flushed;       /**< flush_requests written out              */
+	_Atomic uint64_t dropped;       /**< Records dropped since initialized       */
+	fifo_wait_t wait;               /**< Where the background thread parks       */
+	fifo_wait_t flush_wait;         /**< Where logger_flush callers park         */
+} logger_t;
+
+/**
+ * @brief Initializes the logger and starts its background thread
+ *
+ * @param[out] logger The logger instance
+ * @param[in] fd File descriptor to write to, not closed by the logger
+ * @param[in] records Buffer size of each thread, in records, 0 for LOGGER_RECORDS
+ * @return 0, or -1 on error (see errno)
+ */
+int logger_init(logger_t * logger, int fd, uint32_t records);
+
+/**
+ * @brief Logs a line, formatted later like printf. Never blocks.
+ *        @p format is kept by pointer, so it must stay valid (a string literal).
+ *        Supports the d i u o x X c s p f F e E g G a A conversions with flags,
+ *        width and precision (not *), and the hh h l ll j z t length modifiers.
+ *        String arguments are copied, truncated to LOGGER_TEXT bytes in total.
+ *        Arguments beyond LOGGER_ARGS are not printed.
+ *
+ * @param[in] logger The logger instance
+ * @param[in] format printf format
+ * @return false if the buffer of the calling thread was full and the line dropped
+ */
+bool logger_printf(logger_t * logger, const char * format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Blocks until every line logged before the call is written
+ *
+ * @param[in] logger The logger instance
+ */
+void logger_flush(logger_t * logger);
+
+/**
+ * @brief Number of lines dropped because a thread buffer was full
+ *
+ * @param[in] logger The logger instance
+ * @return Lines dropped since the logger was initialized
+ */
+uint64_t logger_dropped(logger_t * logger);
+
+/**
+ * @brief Writes everything logged, stops the background thread and releases the
+ *        logger. No thread may log from now on.
+ *
+ * @param[in] logger The logger instance
+ */
+void logger_destroy(logger_t * logger);
+
+/** @} */
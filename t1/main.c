@@ -3,22 +3,25 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <time.h>
+#include <unistd.h>
 #include "fifo.h"
-#include "sem.h"
+#include "pool.h"
+#include "logger.h"
 
 #define N 10          // Tamanho da fila (quantidade de mensagens)
 #define ITERACOES 50  // Numero total de dados a colocar na fila por produtor
+#define TAM_MSG   100 // Tamanho maximo da mensagem
 
 typedef struct {
-	semaphore_t sem;
-	char s[];
+	char s[TAM_MSG];
 } dados_t;
 
 fifo_t fila;           // Fila de N posicoes
+pool_t pool;           // Memoria das mensagens, liberadas pela fila apos todos lerem
 uint32_t produtores;   // Quantidade de produtores
 uint32_t consumidores; // Quantidade de consumidores
 int * ids;             // IDs das threads
-pthread_mutex_t print_mutex;
+logger_t logger;       // Saida formatada e escrita em lotes por outra thread
 
 void deposita(dados_t * dados) {
 	fifo_push(&fila, dados);
@@ -34,11 +37,9 @@ void * f_produtor(void * p) {
 	int id = *(int *)p; // Thread ID
 
 	for (int i=0; i<ITERACOES; i++) {
-		dados_t * dados = (dados_t *)malloc(sizeof(dados_t) + 100);
-		sem_create(&dados->sem, consumidores);
-		snprintf(dados->s, 100, "Thread %d: %p", id, dados);
-		printf("Produzido (%d): %s\n", id, dados->s);
-		fflush(stdout);
+		dados_t * dados = (dados_t *)fifo_alloc(&fila, sizeof(dados_t));
+		snprintf(dados->s, TAM_MSG, "Thread %d: %p", id, dados);
+		logger_printf(&logger, "Produzido (%d): %s\n", id, dados->s);
 		deposita(dados);
 	}
 	return NULL;
@@ -49,10 +50,7 @@ void * f_consumidor(void * p) {
 
 	for (uint32_t i=0; i<ITERACOES * produtores; i++) {
 		dados_t * dados = consome(id);
-		printf("Consumido (%d): %s\n", id, dados->s);
-		fflush(stdout);
-		if (!sem_wait(&dados->sem))
-			free(dados);
+		logger_printf(&logger, "Consumido (%d): %s\n", id, dados->s);
 	}
 	return NULL;
 }
@@ -67,9 +65,16 @@ int main(int argc, char ** argv) {
 
 	produtores   = atoi(argv[1]);
 	consumidores = atoi(argv[2]);
-	printf("Inicio - %u produtores, %u consumidores\n", produtores, consumidores);
+	if (logger_init(&logger, STDOUT_FILENO, 0) < 0) {
+		perror("logger_init");
+		return 1;
+	}
+	logger_printf(&logger, "Inicio - %u produtores, %u consumidores\n", produtores,
+	              consumidores);
 
 	fifo_init(&fila, N, consumidores);
+	pool_init(&pool);
+	fifo_set_pool(&fila, &pool);
 	
 	int qtd_ids = produtores > consumidores ? produtores : consumidores;
 	ids = (int *)malloc(qtd_ids * sizeof(int));
@@ -89,8 +94,10 @@ int main(int argc, char ** argv) {
 	for (int i=0; i<produtores + consumidores; i++)
 		pthread_join(threads[i], NULL);
 
-	printf("Fim\n");
+	logger_printf(&logger, "Fim\n");
+	logger_destroy(&logger);
 	fifo_destroy(&fila);
+	pool_destroy(&pool);
 	free(ids);
 	free(threads);
 	pthread_attr_destroy(&attr);
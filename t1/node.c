@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "node.h"
+
+#define NODE_PATH "/sys/devices/system/node"
+
+// Reads a sysfs CPU/node list ("0-3,8,10-11") into set. Returns the highest entry,
+// -1 if the file can't be read.
+static int read_list(const char * path, cpu_set_t * set) {
+	FILE * f = fopen(path, "r");
+	if (!f)
+		return -1;
+	char line[4096];
+	int max = -1;
+	if (fgets(line, sizeof(line), f)) {
+		char * p = line;
+		while (*p >= '0' && *p <= '9') {
+			int first = (int)strtol(p, &p, 10);
+			int last = first;
+			if (*p == '-')
+				last = (int)strtol(p + 1, &p, 10);
+			for (int i=first; i<=last && i<CPU_SETSIZE; i++) {
+				if (set)
+					CPU_SET(i, set);
+				max = i;
+			}
+			if (*p == ',')
+				p++;
+		}
+	}
+	fclose(f);
+	return max;
+}
+
+int node_count(void) {
+	int max = read_list(NODE_PATH "/possible", NULL);
+	return max < 0 ? 1 : max + 1;
+}
+
+int node_current(void) {
+	unsigned cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0)
+		return 0;
+	return (int)node;
+}
+
+int node_bind_thread(int node) {
+	if (node < 0 || node >= node_count()) {
+		errno = EINVAL;
+		return -1;
+	}
+	char path[64];
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	snprintf(path, sizeof(path), NODE_PATH "/node%d/cpulist", node);
+	if (read_list(path, &set) < 0) {
+		// Kernels without NUMA have no node directory: everything is node 0
+		if (node)
+			return -1;
+		sched_getaffinity(0, sizeof(set), &set);
+	}
+	if (!CPU_COUNT(&set)) {
+		// Memory only node
+		errno = EINVAL;
+		return -1;
+	}
+	int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+size_t node_page_size(void) {
+	return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static size_t round_pages(size_t size) {
+	size_t page = node_page_size();
+	return (size + page - 1) / page * page;
+}
+
+int node_place(void * p, size_t size, int node) {
+	// Nothing to choose from on a single node. Placement is a hint: if the kernel
+	// refuses it, pages come from the node of the thread touching them.
+	if (node < 0 || node_count() < 2)
+		return 0;
+	unsigned long mask[node / (8 * sizeof(unsigned long)) + 1];
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+	// The kernel takes one bit less than maxnode
+	return syscall(SYS_mbind, p, round_pages(size), MPOL_PREFERRED, mask,
+	               8 * sizeof(mask) + 1, 0) < 0 ? -1 : 0;
+}
+
+int node_of(const void * p) {
+	int node;
+	if (syscall(SYS_get_mempolicy, &node, NULL, 0, p, MPOL_F_NODE | MPOL_F_ADDR) < 0) {
+		// Kernels without NUMA: everything is node 0
+		return errno == ENOSYS ? 0 : -1;
+	}
+	return node;
+}
+
+void * node_alloc(size_t size, int node) {
+	// Fresh anonymous pages: zeroed, and not placed until first touched, so the
+	// policy set here decides where they go
+	void * p = mmap(NULL, round_pages(size), PROT_READ | PROT_WRITE,
+	                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	node_place(p, size, node);
+	return p;
+}
+
+void node_free(void * p, size_t size) {
+	if (p)
+		munmap(p, round_pages(size));
+}
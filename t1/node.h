@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @defgroup node Node
+ * @brief NUMA placement helpers: which node a thread runs on, binding threads to
+ *        the CPUs of a node, and memory placed on a node.
+ *        Uses the kernel interfaces directly (sysfs, getcpu, mbind), no library.
+ *        On machines with a single node, or kernels without NUMA, placement does
+ *        nothing and everything is node 0.
+ * @{
+ */
+
+/**
+ * @brief Number of NUMA nodes of the machine
+ *
+ * @return Nodes, at least 1
+ */
+int node_count(void);
+
+/**
+ * @brief Node of the CPU the calling thread runs on now
+ *
+ * @return Node, 0 if unknown
+ */
+int node_current(void);
+
+/**
+ * @brief Makes the calling thread run only on the CPUs of @p node. Its memory then
+ *        comes from that node when first touched.
+ *
+ * @param[in] node Node (0 to node_count() - 1)
+ * @return 0, or -1 on error (see errno)
+ */
+int node_bind_thread(int node);
+
+/**
+ * @brief Allocates zeroed memory placed on @p node. Pages come from another node
+ *        if it has no free memory.
+ *
+ * @param[in] size Size in bytes, rounded up to whole pages
+ * @param[in] node Node, or -1 for the node of the thread that first touches each page
+ * @return Page aligned memory, NULL on error (see errno)
+ */
+void * node_alloc(size_t size, int node);
+
+/**
+ * @brief Moves the placement of part of a node_alloc area to @p node. Only pages
+ *        not touched yet are affected.
+ *
+ * @param[in] p Page aligned start
+ * @param[in] size Size in bytes, rounded up to whole pages
+ * @param[in] node Node
+ * @return 0, or -1 if the kernel refused it (see errno)
+ */
+int node_place(void * p, size_t size, int node);
+
+/**
+ * @brief Node holding the page of @p p, which must have been touched
+ *
+ * @param[in] p Any address of the page
+ * @return Node, or -1 on error (see errno)
+ */
+int node_of(const void * p);
+
+/**
+ * @brief Releases memory from node_alloc
+ *
+ * @param[in] p The memory, or NULL
+ * @param[in] size Size given to node_alloc
+ */
+void node_free(void * p, size_t size);
+
+/**
+ * @brief Page size, the unit of placement
+ *
+ * @return Bytes
+ */
+size_t node_page_size(void);
+
+/** @} */
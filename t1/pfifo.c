@@ -0,0 +1,61 @@
+#include "pfifo.h"
+
+// Rounds over all lanes before parking
+#define PFIFO_SPIN 64
+
+void pfifo_init(pfifo_t * pfifo, uint32_t lanes, const uint32_t * lengths,
+                uint32_t consumers) {
+	pfifo->count = lanes;
+	fifo_wait_init(&pfifo->wait);
+	for (uint32_t i=0; i<lanes; i++)
+		fifo_init(&pfifo->lanes[i].fifo, lengths[i], consumers);
+}
+
+void pfifo_push(pfifo_t * pfifo, uint32_t lane, void * p) {
+	fifo_push(&pfifo->lanes[lane].fifo, p);
+	fifo_wait_wake(&pfifo->wait);
+}
+
+bool pfifo_try_push(pfifo_t * pfifo, uint32_t lane, void * p) {
+	if (!fifo_try_push(&pfifo->lanes[lane].fifo, p))
+		return false;
+	fifo_wait_wake(&pfifo->wait);
+	return true;
+}
+
+bool pfifo_try_pop(pfifo_t * pfifo, uint32_t consumer, void ** out, uint32_t * lane) {
+	// Always from the top: a higher lane may have been pushed since the last pop
+	for (uint32_t i=0; i<pfifo->count; i++) {
+		if (fifo_try_pop(&pfifo->lanes[i].fifo, consumer, out)) {
+			if (lane)
+				*lane = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Condition of pfifo_pop: popped from any lane
+typedef struct {
+	pfifo_t * pfifo;
+	uint32_t consumer;
+	void ** out;
+	uint32_t lane;
+} pfifo_poll_t;
+
+static bool popped(void * p) {
+	pfifo_poll_t * poll = (pfifo_poll_t *)p;
+	return pfifo_try_pop(poll->pfifo, poll->consumer, poll->out, &poll->lane);
+}
+
+uint32_t pfifo_pop(pfifo_t * pfifo, uint32_t consumer, void ** out) {
+	pfifo_poll_t poll = { pfifo, consumer, out, 0 };
+	fifo_wait_until(&pfifo->wait, PFIFO_SPIN, popped, &poll, NULL);
+	return poll.lane;
+}
+
+void pfifo_destroy(pfifo_t * pfifo) {
+	for (uint32_t i=0; i<pfifo->count; i++)
+		fifo_destroy(&pfifo->lanes[i].fifo);
+	fifo_wait_destroy(&pfifo->wait);
+}
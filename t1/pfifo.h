@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fifo.h"
+
+/**
+ * @defgroup pfifo Priority FIFO
+ * @brief Pointer FIFO with a few priority lanes, each one a FIFO with its own
+ *        length. Lane 0 has the highest priority. Every consumer reads every
+ *        pointer, always from the highest priority lane that has one, and the
+ *        pointers of each producer in a lane in the order they were pushed.
+ *        Lanes don't share space, so producers blocked on a full lane don't delay
+ *        the others.
+ *        Blocks on push if the lane is full.
+ *        For each consumer, block on pop if all lanes are empty.
+ * @{
+ */
+
+#define PFIFO_MAX_LANES 4
+
+/**
+ * @brief One lane, aligned so lanes never share a cache line
+ */
+typedef struct {
+	_Alignas(64) fifo_t fifo;
+} pfifo_lane_t;
+
+/**
+ * @brief priority FIFO instance
+ */
+typedef struct {
+	pfifo_lane_t lanes[PFIFO_MAX_LANES]; /**< One FIFO per lane, highest first  */
+	uint32_t count;                 /**< Number of lanes                         */
+	fifo_wait_t wait;               /**< Consumers waiting for any lane          */
+} pfifo_t;
+
+/**
+ * @brief Initializes the priority FIFO
+ *
+ * @param[in] pfifo The priority FIFO instance
+ * @param[in] lanes Number of lanes (1 to PFIFO_MAX_LANES)
+ * @param[in] lengths Length of each lane, highest priority first
+ * @param[in] consumers Number of consumers
+ */
+void pfifo_init(pfifo_t * pfifo, uint32_t lanes, const uint32_t * lengths,
+                uint32_t consumers);
+
+/**
+ * @brief Adds a pointer to a lane, blocking if it is full
+ *
+ * @param[in] pfifo The priority FIFO instance
+ * @param[in] lane Lane, 0 is the highest priority
+ * @param[in] p The pointer to add
+ */
+void pfifo_push(pfifo_t * pfifo, uint32_t lane, void * p);
+
+/**
+ * @brief Adds a pointer to a lane if it has space, never blocks
+ *
+ * @param[in] pfifo The priority FIFO instance
+ * @param[in] lane Lane, 0 is the highest priority
+ * @param[in] p The pointer to add
+ * @return true if the pointer was added
+ */
+bool pfifo_try_push(pfifo_t * pfifo, uint32_t lane, void * p);
+
+/**
+ * @brief Copy the oldest pointer of the highest priority lane that has one to
+ *        @p out and removes it from the lane. Blocks if all lanes are empty.
+ *
+ * @param[in] pfifo The priority FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @param[out] out Copy destination
+ * @return Lane of the pointer
+ */
+uint32_t pfifo_pop(pfifo_t * pfifo, uint32_t consumer, void ** out);
+
+/**
+ * @brief Like pfifo_pop, but never blocks
+ *
+ * @param[in] pfifo The priority FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @param[out] out Copy destination
+ * @param[out] lane Lane of the pointer, can be NULL
+ * @return true if a pointer was copied to @p out
+ */
+bool pfifo_try_pop(pfifo_t * pfifo, uint32_t consumer, void ** out, uint32_t * lane);
+
+/**
+ * @brief Releases any resources held by the priority FIFO
+ *
+ * @param[in] pfifo The priority FIFO instance
+ */
+void pfifo_destroy(pfifo_t * pfifo);
+
+/** @} */
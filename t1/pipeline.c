@@ -0,0 +1,290 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "pipeline.h"
+
+// Counters of one stage in one thread, written only by that thread
+typedef struct {
+	_Atomic uint64_t in;
+	_Atomic uint64_t out;
+	_Atomic uint64_t busy_ns;
+} pipeline_counters_t;
+
+typedef struct {
+	_Alignas(64) pipeline_t * pipeline;
+	pipeline_segment_t * segment;
+	pthread_t thread;
+	pipeline_counters_t counters[PIPELINE_MAX_STAGES]; // By position in the segment
+} pipeline_worker_t;
+
+// Stages run one after the other by the same threads
+struct pipeline_segment {
+	uint32_t stages[PIPELINE_MAX_STAGES];
+	uint32_t count;
+	uint32_t parallelism;
+	fifo_t * input;                 // Output FIFO of the segment before, NULL for a source
+	uint32_t consumer;              // Consumer ID in input
+	fifo_t output;                  // To the segments after, if any
+	uint32_t outputs;               // Number of segments after
+	uint32_t markers;               // End markers pushed to output when done
+	pipeline_worker_t * workers;
+	atomic_uint running;            // Workers that didn't finish yet
+	_Atomic uint64_t finished_ns;   // When the last worker finished, 0 before
+};
+
+// Tells the segments after that a segment is done. Never a real item.
+static char end_marker;
+#define END ((void *)&end_marker)
+
+static uint64_t now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static inline void add(_Atomic uint64_t * counter, uint64_t n) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+	                      memory_order_relaxed);
+}
+
+// Calls the stage at position i of the segment
+static void * call(pipeline_worker_t * w, uint32_t i, void * item) {
+	pipeline_stage_t * stage = &w->pipeline->stages[w->segment->stages[i]];
+	uint64_t start = now_ns();
+	void * out = stage->fn(stage->arg, item);
+	add(&w->counters[i].busy_ns, now_ns() - start);
+	if (item)
+		add(&w->counters[i].in, 1);
+	if (out)
+		add(&w->counters[i].out, 1);
+	return out;
+}
+
+// Stops reading the input, so the markers left there don't block the segment
+// before, and tells the segments after. Each of their threads stops at one
+// marker, so there must be one for every thread of the largest.
+static void finish_segment(pipeline_segment_t * seg) {
+	if (seg->input)
+		fifo_detach(seg->input, seg->consumer);
+	for (uint32_t i=0; i<seg->markers; i++)
+		fifo_push(&seg->output, END);
+	atomic_store(&seg->finished_ns, now_ns());
+}
+
+static void * worker(void * p) {
+	pipeline_worker_t * w = (pipeline_worker_t *)p;
+	pipeline_segment_t * seg = w->segment;
+	for (;;) {
+		// The first stage takes an item from the segment before, or makes one
+		void * item = NULL;
+		if (seg->input) {
+			fifo_pop(seg->input, seg->consumer, &item);
+			if (item == END)
+				break;
+		} else if (atomic_load_explicit(&w->pipeline->stop, memory_order_relaxed)) {
+			break;
+		}
+
+		item = call(w, 0, item);
+		if (!item && !seg->input)
+			break;
+		for (uint32_t i=1; i<seg->count && item; i++)
+			item = call(w, i, item);
+		if (item && seg->outputs)
+			fifo_push(&seg->output, item);
+	}
+
+	// The last worker out finishes the segment
+	if (atomic_fetch_sub(&seg->running, 1) == 1)
+		finish_segment(seg);
+	return NULL;
+}
+
+// pipeline_start could only start the segments before failed, and started
+// workers of failed. Stops what runs and releases everything.
+static void abort_start(pipeline_t * pipeline, uint32_t failed, uint32_t started) {
+	atomic_store(&pipeline->stop, true);
+
+	// The segments that didn't start finish right away. They stop reading first,
+	// so the markers they push don't wait for each other.
+	uint32_t first = started ? failed + 1 : failed;
+	for (uint32_t i=first; i<pipeline->segment_count; i++) {
+		pipeline_segment_t * seg = &pipeline->segments[i];
+		if (seg->input)
+			fifo_detach(seg->input, seg->consumer);
+		seg->input = NULL;
+	}
+	for (uint32_t i=first; i<pipeline->segment_count; i++)
+		finish_segment(&pipeline->segments[i]);
+
+	// The one that started in part finishes when its started workers do
+	if (started) {
+		pipeline_segment_t * seg = &pipeline->segments[failed];
+		uint32_t missing = seg->parallelism - started;
+		if (atomic_fetch_sub(&seg->running, missing) == missing)
+			finish_segment(seg);
+	}
+
+	for (uint32_t i=0; i<=failed && i<pipeline->segment_count; i++) {
+		pipeline_segment_t * seg = &pipeline->segments[i];
+		uint32_t count = i < failed ? seg->parallelism : started;
+		for (uint32_t k=0; k<count; k++)
+			pthread_join(seg->workers[k].thread, NULL);
+	}
+	pipeline_destroy(pipeline);
+}
+
+// True if stage id runs in the threads of its input stage
+static bool fusable(pipeline_t * pipeline, uint32_t id) {
+	pipeline_stage_t * stage = &pipeline->stages[id];
+	if (stage->input < 0)
+		return false;
+	pipeline_stage_t * input = &pipeline->stages[stage->input];
+	return input->outputs == 1 && (input->flags & PIPELINE_STATELESS)
+	       && (stage->flags & PIPELINE_STATELESS)
+	       && input->parallelism == stage->parallelism;
+}
+
+void pipeline_init(pipeline_t * pipeline, uint32_t length) {
+	pipeline->count = 0;
+	pipeline->length = length ? length : PIPELINE_LENGTH;
+	pipeline->segments = NULL;
+	pipeline->segment_count = 0;
+	atomic_init(&pipeline->stop, false);
+	pipeline->start_ns = 0;
+}
+
+int pipeline_add(pipeline_t * pipeline, const char * name, pipeline_fn_t fn, void * arg,
+                 uint32_t parallelism, uint32_t flags) {
+	if (pipeline->count == PIPELINE_MAX_STAGES)
+		return -1;
+	pipeline_stage_t * stage = &pipeline->stages[pipeline->count];
+	stage->name = name;
+	stage->fn = fn;
+	stage->arg = arg;
+	stage->parallelism = parallelism;
+	stage->flags = flags;
+	stage->input = -1;
+	stage->outputs = 0;
+	stage->segment = NULL;
+	stage->position = 0;
+	return pipeline->count++;
+}
+
+bool pipeline_connect(pipeline_t * pipeline, uint32_t from, uint32_t to) {
+	pipeline_stage_t * stage = &pipeline->stages[to];
+	if (stage->input >= 0)
+		return false;
+	stage->input = from;
+	pipeline->stages[from].output[pipeline->stages[from].outputs++] = to;
+	return true;
+}
+
+int pipeline_start(pipeline_t * pipeline) {
+	pipeline->segments = (pipeline_segment_t *)calloc(pipeline->count,
+	                                                  sizeof(pipeline_segment_t));
+	if (!pipeline->segments)
+		return -1;
+
+	// A segment starts at every stage that can't be fused to its input, and goes
+	// on while the next stage can
+	for (uint32_t id=0; id<pipeline->count; id++) {
+		if (fusable(pipeline, id))
+			continue;
+		pipeline_segment_t * seg = &pipeline->segments[pipeline->segment_count++];
+		seg->parallelism = pipeline->stages[id].parallelism;
+		for (uint32_t s=id; ; s=pipeline->stages[s].output[0]) {
+			pipeline->stages[s].segment = seg;
+			pipeline->stages[s].position = seg->count;
+			seg->stages[seg->count++] = s;
+			if (pipeline->stages[s].outputs != 1
+			    || !fusable(pipeline, pipeline->stages[s].output[0]))
+				break;
+		}
+	}
+
+	// One FIFO out of each segment with outputs. Each segment after is a consumer
+	// of it, shared by its threads.
+	for (uint32_t i=0; i<pipeline->segment_count; i++) {
+		pipeline_segment_t * seg = &pipeline->segments[i];
+		pipeline_stage_t * last = &pipeline->stages[seg->stages[seg->count - 1]];
+		seg->outputs = last->outputs;
+		if (!seg->outputs)
+			continue;
+		fifo_init(&seg->output, pipeline->length, seg->outputs);
+		for (uint32_t k=0; k<last->outputs; k++) {
+			pipeline_segment_t * next = pipeline->stages[last->output[k]].segment;
+			next->input = &seg->output;
+			next->consumer = k;
+			if (next->parallelism > 1)
+				fifo_set_group(&seg->output, k);
+			if (next->parallelism > seg->markers)
+				seg->markers = next->parallelism;
+		}
+	}
+
+	pipeline->start_ns = now_ns();
+	for (uint32_t i=0; i<pipeline->segment_count; i++) {
+		pipeline_segment_t * seg = &pipeline->segments[i];
+		seg->workers = (pipeline_worker_t *)aligned_alloc(_Alignof(pipeline_worker_t),
+		                                                  seg->parallelism
+		                                                  * sizeof(pipeline_worker_t));
+		memset(seg->workers, 0, seg->parallelism * sizeof(pipeline_worker_t));
+		atomic_init(&seg->running, seg->parallelism);
+		atomic_init(&seg->finished_ns, 0);
+		for (uint32_t k=0; k<seg->parallelism; k++) {
+			pipeline_worker_t * w = &seg->workers[k];
+			w->pipeline = pipeline;
+			w->segment = seg;
+			int error = pthread_create(&w->thread, NULL, worker, w);
+			if (error) {
+				abort_start(pipeline, i, k);
+				errno = error;
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+void pipeline_stop(pipeline_t * pipeline) {
+	atomic_store(&pipeline->stop, true);
+}
+
+void pipeline_wait(pipeline_t * pipeline) {
+	for (uint32_t i=0; i<pipeline->segment_count; i++) {
+		pipeline_segment_t * seg = &pipeline->segments[i];
+		for (uint32_t k=0; k<seg->parallelism; k++)
+			pthread_join(seg->workers[k].thread, NULL);
+	}
+}
+
+void pipeline_stats(pipeline_t * pipeline, uint32_t stage, pipeline_stats_t * stats) {
+	pipeline_segment_t * seg = pipeline->stages[stage].segment;
+	uint32_t i = pipeline->stages[stage].position;
+	memset(stats, 0, sizeof(pipeline_stats_t));
+	for (uint32_t k=0; k<seg->parallelism; k++) {
+		pipeline_counters_t * c = &seg->workers[k].counters[i];
+		stats->in += atomic_load_explicit(&c->in, memory_order_relaxed);
+		stats->out += atomic_load_explicit(&c->out, memory_order_relaxed);
+		stats->busy_ns += atomic_load_explicit(&c->busy_ns, memory_order_relaxed);
+	}
+	uint64_t end = atomic_load(&seg->finished_ns);
+	stats->elapsed_ns = (end ? end : now_ns()) - pipeline->start_ns;
+	stats->threads = seg->parallelism;
+	stats->fused = i > 0;
+}
+
+void pipeline_destroy(pipeline_t * pipeline) {
+	for (uint32_t i=0; i<pipeline->segment_count; i++) {
+		pipeline_segment_t * seg = &pipeline->segments[i];
+		if (seg->outputs)
+			fifo_destroy(&seg->output);
+		free(seg->workers);
+	}
+	free(pipeline->segments);
+	pipeline->segments = NULL;
+	pipeline->segment_count = 0;
+}
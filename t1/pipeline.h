@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "fifo.h"
+
+/**
+ * @defgroup pipeline Pipeline
+ * @brief Graph of stages connected by FIFOs. Each stage is a function called for
+ *        every item, by as many threads as its parallelism.
+ *        A stage without input is a source: it is called with NULL and returns a
+ *        new item each time, or NULL once it is done. Every other stage has one
+ *        input stage, and is called with each item the input stage produces. It
+ *        returns the item to pass on, or NULL to drop it. A stage connected to
+ *        several output stages sends every item to all of them (fan-out), and the
+ *        threads of a stage share its items.
+ *        Edges are bounded FIFOs, so a slow stage blocks the ones before it
+ *        (backpressure). When the sources are done, or after pipeline_stop, every
+ *        stage finishes the items already queued and its threads exit.
+ *        Consecutive stateless stages with the same parallelism, where the first
+ *        has no other output, run fused in the same threads, without a FIFO
+ *        between them.
+ * @{
+ */
+
+#define PIPELINE_MAX_STAGES 16     /**< Stages in a pipeline                         */
+#define PIPELINE_LENGTH     64     /**< Default length of the FIFOs between stages   */
+
+/** @brief Stage flag: the function keeps no state between calls, so it can be fused */
+#define PIPELINE_STATELESS  1
+
+/**
+ * @brief Stage function
+ *
+ * @param[in] arg Argument given to pipeline_add
+ * @param[in] item Item from the input stage, NULL for a source
+ * @return Item for the output stages, or NULL to drop it (or, from a source, to
+ *         finish)
+ */
+typedef void * (*pipeline_fn_t)(void * arg, void * item);
+
+typedef struct pipeline_segment pipeline_segment_t;
+
+/**
+ * @brief One stage, as declared
+ */
+typedef struct {
+	const char * name;
+	pipeline_fn_t fn;
+	void * arg;
+	uint32_t parallelism;           /**< Threads calling fn                      */
+	uint32_t flags;                 /**< PIPELINE_STATELESS                      */
+	int32_t input;                  /**< Input stage, -1 for a source            */
+	uint32_t outputs;               /**< Number of output stages                 */
+	uint32_t output[PIPELINE_MAX_STAGES]; /**< Output stages                     */
+	pipeline_segment_t * segment;   /**< Threads running the stage, once started */
+	uint32_t position;              /**< Position of the stage in its segment    */
+} pipeline_stage_t;
+
+/**
+ * @brief Counters of one stage
+ */
+typedef struct {
+	uint64_t in;                    /**< Items received, 0 for a source          */
+	uint64_t out;                   /**< Items passed on                         */
+	uint64_t busy_ns;               /**< Time spent in the stage function        */
+	uint64_t elapsed_ns;            /**< Since pipeline_start, until the stage
+	                                     finished                                  */
+	uint32_t threads;               /**< Threads running the stage               */
+	bool fused;                     /**< Runs in the threads of its input stage  */
+} pipeline_stats_t;
+
+/**
+ * @brief Pipeline instance
+ */
+typedef struct {
+	pipeline_stage_t stages[PIPELINE_MAX_STAGES];
+	uint32_t count;                 /**< Number of stages                        */
+	uint32_t length;                /**< Length of the FIFOs between stages      */
+	pipeline_segment_t * segments;  /**< Groups of fused stages, once started    */
+	uint32_t segment_count;
+	atomic_bool stop;               /**< Sources stop producing                  */
+	uint64_t start_ns;              /**< CLOCK_MONOTONIC time of pipeline_start  */
+} pipeline_t;
+
+/**
+ * @brief Initializes an empty pipeline
+ *
+ * @param[out] pipeline The pipeline instance
+ * @param[in] length Length of the FIFOs between stages, 0 for PIPELINE_LENGTH
+ */
+void pipeline_init(pipeline_t * pipeline, uint32_t length);
+
+/**
+ * @brief Declares a stage
+ *
+ * @param[in] pipeline The pipeline instance (not started)
+ * @param[in] name Stage name, kept by pointer
+ * @param[in] fn Stage function. Called concurrently if @p parallelism > 1.
+ * @param[in] arg Argument of fn
+ * @param[in] parallelism Number of threads (> 0)
+ * @param[in] flags PIPELINE_STATELESS or 0
+ * @return Stage ID, -1 if there are already PIPELINE_MAX_STAGES stages
+ */
+int pipeline_add(pipeline_t * pipeline, const char * name, pipeline_fn_t fn, void * arg,
+                 uint32_t parallelism, uint32_t flags);
+
+/**
+ * @brief Sends the items of stage @p from to stage @p to
+ *
+ * @param[in] pipeline The pipeline instance (not started)
+ * @param[in] from Stage ID
+ * @param[in] to Stage ID, of a stage without input yet
+ * @return false if @p to already has an input
+ */
+bool pipeline_connect(pipeline_t * pipeline, uint32_t from, uint32_t to);
+
+/**
+ * @brief Fuses stages, creates the FIFOs and starts the threads. On error, the
+ *        threads already started are stopped and joined, and the FIFOs released.
+ *
+ * @param[in] pipeline The pipeline instance
+ * @return 0, or -1 on error (see errno)
+ */
+int pipeline_start(pipeline_t * pipeline);
+
+/**
+ * @brief Makes the sources stop. The rest of the pipeline finishes the items
+ *        already produced. Doesn't wait, see pipeline_wait.
+ *
+ * @param[in] pipeline The pipeline instance
+ */
+void pipeline_stop(pipeline_t * pipeline);
+
+/**
+ * @brief Blocks until every stage finished
+ *
+ * @param[in] pipeline The pipeline instance
+ */
+void pipeline_wait(pipeline_t * pipeline);
+
+/**
+ * @brief Counters of a stage. Any thread can call it while the pipeline runs.
+ *
+ * @param[in] pipeline The pipeline instance (started)
+ * @param[in] stage Stage ID
+ * @param[out] stats Counters
+ */
+void pipeline_stats(pipeline_t * pipeline, uint32_t stage, pipeline_stats_t * stats);
+
+/**
+ * @brief Releases the FIFOs and threads. Must be called after pipeline_wait.
+ *
+ * @param[in] pipeline The pipeline instance
+ */
+void pipeline_destroy(pipeline_t * pipeline);
+
+/** @} */
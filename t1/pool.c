@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include "pool.h"
+
+#define POOL_SLAB_SIZE  (64 * 1024) // Minimum slab size
+#define POOL_BATCH      32          // Buffers moved between a thread cache and the pool at once
+#define POOL_CACHE_MAX  64          // Maximum buffers per size class in a thread cache
+#define POOL_LARGE      POOL_CLASSES
+
+// Header in front of every buffer. next overlaps the first bytes of the buffer, so
+// it is only valid while the buffer is free.
+struct pool_block {
+	pool_t * pool;
+	size_t cls;
+	pool_block_t * next;
+};
+
+#define HEADER_SIZE offsetof(pool_block_t, next)
+
+struct pool_slab {
+	pool_slab_t * next;
+	max_align_t data[];
+};
+
+struct pool_cache {
+	pool_t * pool;
+	pool_cache_t * next;
+	pool_block_t * head[POOL_CLASSES];
+	uint32_t count[POOL_CLASSES];
+};
+
+static inline void * payload(pool_block_t * b) {
+	return (uint8_t *)b + HEADER_SIZE;
+}
+
+static inline pool_block_t * block(void * p) {
+	return (pool_block_t *)((uint8_t *)p - HEADER_SIZE);
+}
+
+static inline size_t class_size(size_t cls) {
+	return (size_t)POOL_MIN_SIZE << cls;
+}
+
+static size_t size_class(size_t size) {
+	size_t cls = 0;
+	while (cls < POOL_LARGE && class_size(cls) < size)
+		cls++;
+	return cls;
+}
+
+// Carves a new slab into buffers of class cls. Called with the mutex locked.
+static bool grow(pool_t * pool, size_t cls) {
+	size_t block_size = HEADER_SIZE + class_size(cls);
+	size_t count = POOL_SLAB_SIZE / block_size;
+	if (count < POOL_BATCH)
+		count = POOL_BATCH;
+
+	pool_slab_t * slab = (pool_slab_t *)malloc(sizeof(pool_slab_t) + count * block_size);
+	if (!slab)
+		return false;
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+
+	uint8_t * p = (uint8_t *)slab->data;
+	for (size_t i=0; i<count; i++, p += block_size) {
+		pool_block_t * b = (pool_block_t *)p;
+		b->pool = pool;
+		b->cls = cls;
+		b->next = pool->free[cls];
+		pool->free[cls] = b;
+	}
+	return true;
+}
+
+// Moves up to POOL_BATCH free buffers of class cls from the pool to the cache
+static void refill(pool_t * pool, pool_cache_t * cache, size_t cls) {
+	pthread_mutex_lock(&pool->mutex);
+	for (int i=0; i<POOL_BATCH; i++) {
+		if (!pool->free[cls] && !grow(pool, cls))
+			break;
+		pool_block_t * b = pool->free[cls];
+		pool->free[cls] = b->next;
+		b->next = cache->head[cls];
+		cache->head[cls] = b;
+		cache->count[cls]++;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+// Moves up to count buffers of class cls from the cache to the pool
+static void flush(pool_t * pool, pool_cache_t * cache, size_t cls, uint32_t count) {
+	pthread_mutex_lock(&pool->mutex);
+	while (count-- && cache->head[cls]) {
+		pool_block_t * b = cache->head[cls];
+		cache->head[cls] = b->next;
+		cache->count[cls]--;
+		b->next = pool->free[cls];
+		pool->free[cls] = b;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+// Thread exit: give the cached buffers back to the pool
+static void cache_release(void * p) {
+	pool_cache_t * cache = (pool_cache_t *)p;
+	pool_t * pool = cache->pool;
+
+	for (size_t cls=0; cls<POOL_CLASSES; cls++)
+		flush(pool, cache, cls, cache->count[cls]);
+
+	pthread_mutex_lock(&pool->mutex);
+	for (pool_cache_t ** c = &pool->caches; *c; c = &(*c)->next) {
+		if (*c == cache) {
+			*c = cache->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	free(cache);
+}
+
+static pool_cache_t * thread_cache(pool_t * pool) {
+	pool_cache_t * cache = (pool_cache_t *)pthread_getspecific(pool->key);
+	if (cache)
+		return cache;
+
+	cache = (pool_cache_t *)calloc(1, sizeof(pool_cache_t));
+	if (!cache)
+		return NULL;
+	cache->pool = pool;
+	pthread_mutex_lock(&pool->mutex);
+	cache->next = pool->caches;
+	pool->caches = cache;
+	pthread_mutex_unlock(&pool->mutex);
+	pthread_setspecific(pool->key, cache);
+	return cache;
+}
+
+void pool_init(pool_t * pool) {
+	pthread_mutex_init(&pool->mutex, NULL);
+	for (size_t cls=0; cls<POOL_CLASSES; cls++)
+		pool->free[cls] = NULL;
+	pool->slabs = NULL;
+	pool->caches = NULL;
+	pthread_key_create(&pool->key, cache_release);
+}
+
+void * pool_alloc(pool_t * pool, size_t size) {
+	size_t cls = size_class(size);
+	if (cls == POOL_LARGE) {
+		pool_block_t * b = (pool_block_t *)malloc(HEADER_SIZE + size);
+		if (!b)
+			return NULL;
+		b->pool = pool;
+		b->cls = POOL_LARGE;
+		return payload(b);
+	}
+
+	pool_cache_t * cache = thread_cache(pool);
+	if (!cache)
+		return NULL;
+	if (!cache->head[cls])
+		refill(pool, cache, cls);
+
+	pool_block_t * b = cache->head[cls];
+	if (!b)
+		return NULL;
+	cache->head[cls] = b->next;
+	cache->count[cls]--;
+	return payload(b);
+}
+
+void pool_free(void * p) {
+	if (!p)
+		return;
+
+	pool_block_t * b = block(p);
+	if (b->cls == POOL_LARGE) {
+		free(b);
+		return;
+	}
+
+	pool_t * pool = b->pool;
+	pool_cache_t * cache = thread_cache(pool);
+	if (!cache) {
+		pthread_mutex_lock(&pool->mutex);
+		b->next = pool->free[b->cls];
+		pool->free[b->cls] = b;
+		pthread_mutex_unlock(&pool->mutex);
+		return;
+	}
+
+	b->next = cache->head[b->cls];
+	cache->head[b->cls] = b;
+	if (++cache->count[b->cls] > POOL_CACHE_MAX)
+		flush(pool, cache, b->cls, POOL_BATCH);
+}
+
+void pool_destroy(pool_t * pool) {
+	pthread_key_delete(pool->key);
+
+	while (pool->caches) {
+		pool_cache_t * next = pool->caches->next;
+		free(pool->caches);
+		pool->caches = next;
+	}
+
+	while (pool->slabs) {
+		pool_slab_t * next = pool->slabs->next;
+		free(pool->slabs);
+		pool->slabs = next;
+	}
+
+	pthread_mutex_destroy(&pool->mutex);
+}
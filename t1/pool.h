@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * @defgroup pool Pool
+ * @brief Thread-safe buffer pool with size classes and per-thread caches.
+ *        Buffers of up to POOL_MAX_SIZE bytes are carved from slabs and recycled,
+ *        larger ones fall back to malloc. Each thread keeps a small cache of free
+ *        buffers per size class, so most allocations and frees don't touch shared
+ *        state.
+ * @{
+ */
+
+#define POOL_CLASSES   12                       /**< 16 bytes to 32 KB                */
+#define POOL_MIN_SIZE  16
+#define POOL_MAX_SIZE  (POOL_MIN_SIZE << (POOL_CLASSES - 1))
+
+typedef struct pool_block pool_block_t;
+typedef struct pool_cache pool_cache_t;
+typedef struct pool_slab pool_slab_t;
+
+/**
+ * @brief Pool instance
+ */
+typedef struct {
+	pthread_mutex_t mutex;               /**< Protects everything below          */
+	pool_block_t * free[POOL_CLASSES];   /**< Shared free lists                  */
+	pool_slab_t * slabs;                 /**< Memory carved into buffers         */
+	pool_cache_t * caches;               /**< Per-thread caches                  */
+	pthread_key_t key;                   /**< Thread cache of the calling thread */
+} pool_t;
+
+/**
+ * @brief Initializes the pool
+ *
+ * @param[in] pool The pool instance
+ */
+void pool_init(pool_t * pool);
+
+/**
+ * @brief Allocates a buffer
+ *
+ * @param[in] pool The pool instance
+ * @param[in] size Buffer size in bytes
+ * @return The buffer, aligned for any type
+ */
+void * pool_alloc(pool_t * pool, size_t size);
+
+/**
+ * @brief Returns a buffer to the pool it was allocated from. Any thread can free it.
+ *
+ * @param[in] p Buffer returned by pool_alloc, or NULL
+ */
+void pool_free(void * p);
+
+/**
+ * @brief Releases all memory of the pool, including buffers not freed yet (except
+ *        the ones larger than POOL_MAX_SIZE).
+ *        Must not be called while other threads are using the pool.
+ *
+ * @param[in] pool The pool instance
+ */
+void pool_destroy(pool_t * pool);
+
+/** @} */
@@ -1,11 +1,19 @@
+#define _POSIX_C_SOURCE 200809L
 #include <pthread.h>
 #include <stdint.h>
+#include <errno.h>
 #include "sem.h"
 
 void sem_create(semaphore_t * sem, uint32_t count) {
 	sem->count = count;
 	pthread_mutex_init(&sem->mutex, NULL);
-	pthread_cond_init(&sem->cond, NULL);
+
+	// Deadlines for sem_timedwait are CLOCK_MONOTONIC
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sem->cond, &attr);
+	pthread_condattr_destroy(&attr);
 }
 
 void sem_destroy(semaphore_t * sem) {
@@ -23,6 +31,34 @@ uint32_t sem_wait(semaphore_t * sem) {
 	return c;
 }
 
+bool sem_trywait(semaphore_t * sem, uint32_t * count) {
+	pthread_mutex_lock(&sem->mutex);
+	bool ok = sem->count > 0;
+	if (ok) {
+		sem->count --;
+		if (count)
+			*count = sem->count;
+	}
+	pthread_mutex_unlock(&sem->mutex);
+	return ok;
+}
+
+bool sem_timedwait(semaphore_t * sem, const struct timespec * deadline, uint32_t * count) {
+	pthread_mutex_lock(&sem->mutex);
+	while (!sem->count) {
+		if (pthread_cond_timedwait(&sem->cond, &sem->mutex, deadline) == ETIMEDOUT
+		    && !sem->count) {
+			pthread_mutex_unlock(&sem->mutex);
+			return false;
+		}
+	}
+	sem->count --;
+	if (count)
+		*count = sem->count;
+	pthread_mutex_unlock(&sem->mutex);
+	return true;
+}
+
 uint32_t sem_signal(semaphore_t * sem) {
 	pthread_mutex_lock(&sem->mutex);
 	uint32_t c = sem->count;
@@ -1,19 +1,34 @@
 #pragma once
 
 #include <stdint.h>
-#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
 
 /**
  * @defgroup sem Semaphore
- * @brief Counting semaphore based on pthreads
+ * @brief Counting semaphore.
+ *        Based on pthreads by default. Build with SEM_FUTEX defined (make SEM_IMPL=futex)
+ *        to use an atomic counter and Linux futexes instead.
  * @{
  */
 
+#ifdef SEM_FUTEX
+#include <stdatomic.h>
+
+typedef struct {
+	atomic_uint count;
+	atomic_uint waiters;       /**< Threads sleeping on the futex            */
+	atomic_uint spin;          /**< Adaptive spin estimate                   */
+} semaphore_t;
+#else
+#include <pthread.h>
+
 typedef struct {
 	uint32_t count;
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 } semaphore_t;
+#endif
 
 /**
  * @brief Creates a semaphore and set the initial count
@@ -31,6 +46,22 @@ void sem_destroy(semaphore_t * sem);
  */
 uint32_t sem_wait(semaphore_t * sem);
 
+/**
+ * @brief Decrements the semaphore counter if it is not 0, never blocks
+ * @param[out] count If not NULL, receives the counter value AFTER decrementing it
+ * @return true if the counter was decremented
+ */
+bool sem_trywait(semaphore_t * sem, uint32_t * count);
+
+/**
+ * @brief Decrements the semaphore counter, blocking the thread until @p deadline
+ *        if the count is 0
+ * @param[in] deadline Absolute CLOCK_MONOTONIC time
+ * @param[out] count If not NULL, receives the counter value AFTER decrementing it
+ * @return true if the counter was decremented, false on timeout
+ */
+bool sem_timedwait(semaphore_t * sem, const struct timespec * deadline, uint32_t * count);
+
 /**
  * @brief Increments the semaphore counter
  * @return The counter value BEFORE incrementing it
@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "sem.h"
+#include "spin.h"
+
+#ifndef SEM_FUTEX
+#error "sem_futex.c must be built with SEM_FUTEX defined"
+#endif
+
+// Upper bound for the adaptive spin before sleeping on the futex
+#define SEM_SPIN_MAX 1000
+
+// Sleeps while *addr == val, until the absolute CLOCK_MONOTONIC deadline if not NULL
+// Returns false on timeout
+static bool futex_wait(atomic_uint * addr, uint32_t val, const struct timespec * deadline) {
+	if (!deadline) {
+		syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+		return true;
+	}
+	return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE, val, deadline, NULL,
+	               FUTEX_BITSET_MATCH_ANY) == 0 || errno != ETIMEDOUT;
+}
+
+static void futex_wake(atomic_uint * addr, int count) {
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// Takes one from the counter if it is not 0. c is the last value seen.
+static inline int try_take(semaphore_t * sem, uint32_t * c) {
+	while (*c) {
+		if (atomic_compare_exchange_weak_explicit(&sem->count, c, *c - 1,
+		                                          memory_order_acquire,
+		                                          memory_order_relaxed))
+			return 1;
+	}
+	return 0;
+}
+
+void sem_create(semaphore_t * sem, uint32_t count) {
+	atomic_init(&sem->count, count);
+	atomic_init(&sem->waiters, 0);
+	atomic_init(&sem->spin, 0);
+}
+
+void sem_destroy(semaphore_t * sem) {
+	(void)sem;
+}
+
+// Spins, then sleeps until the counter is decremented or the deadline (if not NULL)
+static bool wait_until(semaphore_t * sem, const struct timespec * deadline, uint32_t * count) {
+	uint32_t c = atomic_load_explicit(&sem->count, memory_order_relaxed);
+	if (try_take(sem, &c))
+		goto taken;
+
+	// Spin up to twice the recent average before sleeping (same idea as glibc's
+	// adaptive mutexes)
+	uint32_t spin = atomic_load_explicit(&sem->spin, memory_order_relaxed);
+	uint32_t max = spin * 2 + 10;
+	if (max > SEM_SPIN_MAX)
+		max = SEM_SPIN_MAX;
+
+	for (uint32_t i=0; i<max; i++) {
+		spin_relax();
+		c = atomic_load_explicit(&sem->count, memory_order_relaxed);
+		if (try_take(sem, &c)) {
+			atomic_store_explicit(&sem->spin, spin + ((int32_t)(i - spin)) / 8,
+			                      memory_order_relaxed);
+			goto taken;
+		}
+	}
+	atomic_store_explicit(&sem->spin, spin + ((int32_t)(max - spin)) / 8,
+	                      memory_order_relaxed);
+
+	for (;;) {
+		atomic_fetch_add(&sem->waiters, 1);
+		bool timeout = !futex_wait(&sem->count, 0, deadline);
+		atomic_fetch_sub(&sem->waiters, 1);
+
+		c = atomic_load_explicit(&sem->count, memory_order_relaxed);
+		if (try_take(sem, &c))
+			goto taken;
+		if (timeout)
+			return false;
+	}
+
+taken:
+	if (count)
+		*count = c - 1;
+	return true;
+}
+
+uint32_t sem_wait(semaphore_t * sem) {
+	uint32_t c;
+	wait_until(sem, NULL, &c);
+	return c;
+}
+
+bool sem_trywait(semaphore_t * sem, uint32_t * count) {
+	uint32_t c = atomic_load_explicit(&sem->count, memory_order_relaxed);
+	if (!try_take(sem, &c))
+		return false;
+	if (count)
+		*count = c - 1;
+	return true;
+}
+
+bool sem_timedwait(semaphore_t * sem, const struct timespec * deadline, uint32_t * count) {
+	return wait_until(sem, deadline, count);
+}
+
+uint32_t sem_signal(semaphore_t * sem) {
+	uint32_t c = atomic_fetch_add(&sem->count, 1);
+	if (atomic_load(&sem->waiters))
+		futex_wake(&sem->count, 1);
+	return c;
+}
+
+void sem_set(semaphore_t * sem, uint32_t count) {
+	atomic_store(&sem->count, count);
+	if (count && atomic_load(&sem->waiters))
+		futex_wake(&sem->count, INT_MAX);
+}
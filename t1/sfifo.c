@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include "sfifo.h"
+
+// Rounds over all shards before parking
+#define SFIFO_SPIN 64
+
+void sfifo_init(sfifo_t * sfifo, uint32_t length, uint32_t consumers,
+                uint32_t producers, uint32_t shards) {
+	sfifo->shards = (sfifo_shard_t *)aligned_alloc(_Alignof(sfifo_shard_t),
+	                                               shards * sizeof(sfifo_shard_t));
+	sfifo->count = shards;
+	sfifo->consumers = consumers;
+	sfifo->next = (uint32_t *)calloc(consumers, sizeof(uint32_t));
+	fifo_wait_init(&sfifo->wait);
+
+	fifo_config_t config = { .length = length, .consumers = consumers,
+	                         .single_producer = producers <= shards };
+	for (uint32_t i=0; i<shards; i++)
+		fifo_init_config(&sfifo->shards[i].fifo, &config);
+}
+
+void sfifo_push(sfifo_t * sfifo, uint32_t producer, void * p) {
+	fifo_push(&sfifo->shards[producer % sfifo->count].fifo, p);
+	fifo_wait_wake(&sfifo->wait);
+}
+
+bool sfifo_try_pop(sfifo_t * sfifo, uint32_t consumer, void ** out) {
+	// Start after the last shard popped from, so a busy shard doesn't starve the others
+	uint32_t first = sfifo->next[consumer];
+	for (uint32_t i=0; i<sfifo->count; i++) {
+		uint32_t shard = (first + i) % sfifo->count;
+		if (fifo_try_pop(&sfifo->shards[shard].fifo, consumer, out)) {
+			sfifo->next[consumer] = (shard + 1) % sfifo->count;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Condition of sfifo_pop: popped from any shard
+typedef struct {
+	sfifo_t * sfifo;
+	uint32_t consumer;
+	void ** out;
+} sfifo_poll_t;
+
+static bool popped(void * p) {
+	sfifo_poll_t * poll = (sfifo_poll_t *)p;
+	return sfifo_try_pop(poll->sfifo, poll->consumer, poll->out);
+}
+
+void sfifo_pop(sfifo_t * sfifo, uint32_t consumer, void ** out) {
+	sfifo_poll_t poll = { sfifo, consumer, out };
+	fifo_wait_until(&sfifo->wait, SFIFO_SPIN, popped, &poll, NULL);
+}
+
+void sfifo_destroy(sfifo_t * sfifo) {
+	for (uint32_t i=0; i<sfifo->count; i++)
+		fifo_destroy(&sfifo->shards[i].fifo);
+	fifo_wait_destroy(&sfifo->wait);
+	free(sfifo->shards);
+	free(sfifo->next);
+}
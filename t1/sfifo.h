@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fifo.h"
+
+/**
+ * @defgroup sfifo Sharded FIFO
+ * @brief Pointer FIFO split in one sub-FIFO (shard) per producer or group of producers.
+ *        Producers only write to their own shard, so they don't share cache lines
+ *        with producers of other shards. Consumers merge the shards, taking from
+ *        them in turns. Every consumer reads every pointer, and the pointers of
+ *        each producer in the order they were pushed, but there is no order between
+ *        pointers of different shards.
+ *        Blocks on push if the producer shard is full.
+ *        For each consumer, block on pop if all shards are empty.
+ * @{
+ */
+
+/**
+ * @brief One shard, aligned so shards never share a cache line
+ */
+typedef struct {
+	_Alignas(64) fifo_t fifo;
+} sfifo_shard_t;
+
+/**
+ * @brief sharded FIFO instance
+ */
+typedef struct {
+	sfifo_shard_t * shards;         /**< One FIFO per shard                      */
+	uint32_t count;                 /**< Number of shards                        */
+	uint32_t consumers;             /**< Number of consumers                     */
+	uint32_t * next;                /**< Next shard each consumer looks at       */
+	fifo_wait_t wait;               /**< Consumers waiting for any shard         */
+} sfifo_t;
+
+/**
+ * @brief Initializes the sharded FIFO.
+ *        Producer p pushes to shard p % shards. If there are at most as many
+ *        producers as shards, each shard uses the single producer fast path.
+ *
+ * @param[in] sfifo The sharded FIFO instance
+ * @param[in] length Length of each shard
+ * @param[in] consumers Number of consumers
+ * @param[in] producers Number of producers
+ * @param[in] shards Number of shards (> 0)
+ */
+void sfifo_init(sfifo_t * sfifo, uint32_t length, uint32_t consumers,
+                uint32_t producers, uint32_t shards);
+
+/**
+ * @brief Adds a pointer to the shard of @p producer, blocking if it is full
+ *
+ * @param[in] sfifo The sharded FIFO instance
+ * @param[in] producer ID of the producer (0 to producers - 1)
+ * @param[in] p The pointer to add
+ */
+void sfifo_push(sfifo_t * sfifo, uint32_t producer, void * p);
+
+/**
+ * @brief Copy a pointer from any shard to @p out and removes it from the shard.
+ *        Blocks if all shards are empty.
+ *
+ * @param[in] sfifo The sharded FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @param[out] out Copy destination
+ */
+void sfifo_pop(sfifo_t * sfifo, uint32_t consumer, void ** out);
+
+/**
+ * @brief Like sfifo_pop, but never blocks
+ *
+ * @param[in] sfifo The sharded FIFO instance
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @param[out] out Copy destination
+ * @return true if a pointer was copied to @p out
+ */
+bool sfifo_try_pop(sfifo_t * sfifo, uint32_t consumer, void ** out);
+
+/**
+ * @brief Releases any resources held by the sharded FIFO
+ *
+ * @param[in] sfifo The sharded FIFO instance
+ */
+void sfifo_destroy(sfifo_t * sfifo);
+
+/** @} */
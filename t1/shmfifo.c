@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmfifo.h"
+#include "spin.h"
+
+#define SHMFIFO_MAGIC 0x6f66696666686d73ULL
+// Read sequences are a cache line apart, so consumers don't share lines
+#define CURSOR_STRIDE (64 / sizeof(uint64_t))
+
+// Not FUTEX_PRIVATE_FLAG: waiters and wakers are in different processes
+static void futex_wait(atomic_uint * addr, uint32_t val) {
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint * addr) {
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+static inline size_t align_up(size_t n, size_t align) {
+	return (n + align - 1) / align * align;
+}
+
+// Sets the pointers of the handle from the offsets in the header
+static void map_sections(shmfifo_t * shmfifo) {
+	uint8_t * base = (uint8_t *)shmfifo->header;
+	shmfifo->read = (_Atomic uint64_t *)(base + shmfifo->header->read_offset);
+	shmfifo->slots = (_Atomic uint64_t *)(base + shmfifo->header->slots_offset);
+	shmfifo->records = base + shmfifo->header->records_offset;
+}
+
+int shmfifo_create(shmfifo_t * shmfifo, const char * name, uint32_t length,
+                   uint32_t consumers, size_t record_size) {
+	// Every record aligned for any type, sections on their own cache lines
+	record_size = align_up(record_size, _Alignof(max_align_t));
+	size_t read_offset = align_up(sizeof(shmfifo_header_t), 64);
+	size_t slots_offset = read_offset + consumers * CURSOR_STRIDE * sizeof(uint64_t);
+	size_t records_offset = align_up(slots_offset + length * sizeof(uint64_t), 64);
+	size_t size = records_offset + length * record_size;
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+		return -1;
+	void * base;
+	if (ftruncate(fd, size) < 0
+	    || (base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		int error = errno;
+		close(fd);
+		shm_unlink(name);
+		errno = error;
+		return -1;
+	}
+
+	// The object starts zeroed: sequences, cursors and futexes are already 0
+	shmfifo_header_t * header = (shmfifo_header_t *)base;
+	header->length = length;
+	header->consumers = consumers;
+	header->record_size = record_size;
+	header->size = size;
+	header->read_offset = read_offset;
+	header->slots_offset = slots_offset;
+	header->records_offset = records_offset;
+	atomic_store_explicit(&header->magic, SHMFIFO_MAGIC, memory_order_release);
+
+	shmfifo->header = header;
+	shmfifo->fd = fd;
+	map_sections(shmfifo);
+	return 0;
+}
+
+int shmfifo_attach(shmfifo_t * shmfifo, const char * name) {
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return -1;
+
+	// Until the creator sets the size, the object is empty
+	struct stat st;
+	void * base = MAP_FAILED;
+	int error = EAGAIN;
+	if (fstat(fd, &st) < 0)
+		error = errno;
+	else if ((size_t)st.st_size >= sizeof(shmfifo_header_t)) {
+		base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (base == MAP_FAILED)
+			error = errno;
+		else if (atomic_load_explicit(&((shmfifo_header_t *)base)->magic,
+		                              memory_order_acquire) != SHMFIFO_MAGIC) {
+			munmap(base, st.st_size);
+			base = MAP_FAILED;
+		}
+	}
+	if (base == MAP_FAILED) {
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	shmfifo->header = (shmfifo_header_t *)base;
+	shmfifo->fd = fd;
+	map_sections(shmfifo);
+	return 0;
+}
+
+static inline _Atomic uint64_t * cursor(shmfifo_t * shmfifo, uint32_t consumer) {
+	return &shmfifo->read[consumer * CURSOR_STRIDE];
+}
+
+static inline _Atomic uint64_t * slot(shmfifo_t * shmfifo, uint64_t seq) {
+	return &shmfifo->slots[seq % shmfifo->header->length];
+}
+
+static inline void * record(shmfifo_t * shmfifo, uint64_t seq) {
+	shmfifo_header_t * header = shmfifo->header;
+	return shmfifo->records + (seq % header->length) * header->record_size;
+}
+
+static bool is_published(shmfifo_t * shmfifo, uint64_t seq) {
+	return atomic_load_explicit(slot(shmfifo, seq), memory_order_acquire) == seq + 1;
+}
+
+// True if every consumer already read the sequence that used seq's position
+static bool has_space(shmfifo_t * shmfifo, uint64_t seq) {
+	shmfifo_header_t * header = shmfifo->header;
+	uint64_t tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+	if (seq < tail + header->length)
+		return true;
+
+	uint64_t min = atomic_load_explicit(&header->write, memory_order_relaxed);
+	for (uint32_t i=0; i<header->consumers; i++) {
+		uint64_t r = atomic_load(cursor(shmfifo, i));
+		if (r < min)
+			min = r;
+	}
+	while (tail < min && !atomic_compare_exchange_weak(&header->tail, &tail, min));
+	return seq < min + header->length;
+}
+
+// Wakes the processes waiting on event. A seq_cst fence must separate the state
+// change they wait for from this call.
+static void wake(atomic_uint * event, atomic_uint * waiters) {
+	if (!atomic_load_explicit(waiters, memory_order_relaxed))
+		return;
+	atomic_fetch_add(event, 1);
+	futex_wake(event);
+}
+
+// Condition of wait_for, for spin_until
+typedef struct {
+	bool (*ready)(shmfifo_t *, uint64_t);
+	shmfifo_t * shmfifo;
+	uint64_t seq;
+} shmfifo_poll_t;
+
+static bool poll_ready(void * p) {
+	shmfifo_poll_t * poll = (shmfifo_poll_t *)p;
+	return poll->ready(poll->shmfifo, poll->seq);
+}
+
+// Spins, then waits on the event futex until ready(shmfifo, seq)
+static void wait_for(atomic_uint * event, atomic_uint * waiters,
+                     bool (*ready)(shmfifo_t *, uint64_t), shmfifo_t * shmfifo,
+                     uint64_t seq) {
+	shmfifo_poll_t poll = { ready, shmfifo, seq };
+	if (spin_until(poll_ready, &poll, SPIN_POLLS))
+		return;
+
+	atomic_fetch_add(waiters, 1);
+	for (;;) {
+		// A wake after this load changes the event, so futex_wait doesn't sleep
+		uint32_t e = atomic_load(event);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (ready(shmfifo, seq))
+			break;
+		futex_wait(event, e);
+	}
+	atomic_fetch_sub(waiters, 1);
+}
+
+void * shmfifo_claim(shmfifo_t * shmfifo, uint64_t * seq) {
+	shmfifo_header_t * header = shmfifo->header;
+	*seq = atomic_fetch_add_explicit(&header->write, 1, memory_order_relaxed);
+	wait_for(&header->space_event, &header->space_waiters, has_space, shmfifo, *seq);
+	return record(shmfifo, *seq);
+}
+
+void shmfifo_publish(shmfifo_t * shmfifo, uint64_t seq) {
+	shmfifo_header_t * header = shmfifo->header;
+	atomic_store_explicit(slot(shmfifo, seq), seq + 1, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	wake(&header->data_event, &header->data_waiters);
+}
+
+const void * shmfifo_read(shmfifo_t * shmfifo, uint32_t consumer) {
+	shmfifo_header_t * header = shmfifo->header;
+	uint64_t seq = atomic_load_explicit(cursor(shmfifo, consumer), memory_order_relaxed);
+	wait_for(&header->data_event, &header->data_waiters, is_published, shmfifo, seq);
+	return record(shmfifo, seq);
+}
+
+const void * shmfifo_try_read(shmfifo_t * shmfifo, uint32_t consumer) {
+	uint64_t seq = atomic_load_explicit(cursor(shmfifo, consumer), memory_order_relaxed);
+	return is_published(shmfifo, seq) ? record(shmfifo, seq) : NULL;
+}
+
+void shmfifo_release(shmfifo_t * shmfifo, uint32_t consumer) {
+	shmfifo_header_t * header = shmfifo->header;
+	_Atomic uint64_t * read = cursor(shmfifo, consumer);
+	atomic_store_explicit(read, atomic_load_explicit(read, memory_order_relaxed) + 1,
+	                      memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	wake(&header->space_event, &header->space_waiters);
+}
+
+void shmfifo_close(shmfifo_t * shmfifo) {
+	munmap(shmfifo->header, shmfifo->header->size);
+	close(shmfifo->fd);
+}
+
+int shmfifo_unlink(const char * name) {
+	return shm_unlink(name);
+}
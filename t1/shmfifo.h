@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/**
+ * @defgroup shmfifo Shared memory FIFO
+ * @brief Record FIFO shared by processes, for multiple producers and multiple
+ *        consumers. Every consumer reads every record (broadcast), like fifo_t in
+ *        record mode.
+ *        Everything lives in one POSIX shared memory object: cursors, positions and
+ *        the records themselves, referenced by offsets, so each process can map it
+ *        anywhere. Producers write records in place between shmfifo_claim and
+ *        shmfifo_publish, consumers read them in place between shmfifo_read and
+ *        shmfifo_release. Threads wait on futexes in the shared memory.
+ *        One process creates the FIFO, the others attach to it by name.
+ *        Blocks on claim if full.
+ *        For each consumer, block on read if empty.
+ * @{
+ */
+
+/**
+ * @brief Start of the shared memory object. Offsets are from its start.
+ */
+typedef struct {
+	_Atomic uint64_t magic;         /**< SHMFIFO_MAGIC once initialized          */
+	uint32_t length;                /**< FIFO length                             */
+	uint32_t consumers;             /**< Number of consumers                     */
+	uint64_t record_size;           /**< Size of each record (aligned)           */
+	uint64_t size;                  /**< Size of the whole object                */
+	uint64_t read_offset;           /**< Read sequence of each consumer          */
+	uint64_t slots_offset;          /**< Sequence + 1 published at each position */
+	uint64_t records_offset;        /**< Records                                 */
+	_Alignas(64) _Atomic uint64_t write; /**< Next sequence to be claimed       */
+	_Atomic uint64_t tail;          /**< Cached slowest consumer read sequence   */
+	_Alignas(64) atomic_uint data_event;  /**< Futex consumers wait on           */
+	atomic_uint data_waiters;       /**< Number of consumers waiting             */
+	_Alignas(64) atomic_uint space_event; /**< Futex producers wait on           */
+	atomic_uint space_waiters;      /**< Number of producers waiting             */
+} shmfifo_header_t;
+
+/**
+ * @brief Handle of a process to the shared FIFO. Not shared.
+ */
+typedef struct {
+	shmfifo_header_t * header;      /**< Mapped object                           */
+	_Atomic uint64_t * read;        /**< Read sequences, one cache line apart    */
+	_Atomic uint64_t * slots;       /**< Published sequences                     */
+	uint8_t * records;              /**< Records                                 */
+	int fd;                         /**< Shared memory object                    */
+} shmfifo_t;
+
+/**
+ * @brief Creates the shared FIFO and maps it
+ *
+ * @param[out] shmfifo The handle
+ * @param[in] name Shared memory object name, like "/name"; must not exist
+ * @param[in] length FIFO length
+ * @param[in] consumers Number of consumers
+ * @param[in] record_size Record size in bytes
+ * @return 0, or -1 on error (see errno)
+ */
+int shmfifo_create(shmfifo_t * shmfifo, const char * name, uint32_t length,
+                   uint32_t consumers, size_t record_size);
+
+/**
+ * @brief Maps a shared FIFO created by another process
+ *
+ * @param[out] shmfifo The handle
+ * @param[in] name Shared memory object name given to shmfifo_create
+ * @return 0, or -1 on error (see errno). errno is EAGAIN if the creator didn't
+ *         finish initializing it yet.
+ */
+int shmfifo_attach(shmfifo_t * shmfifo, const char * name);
+
+/**
+ * @brief Claims the next record, blocking if the FIFO is full.
+ *        The record must be written and then published with shmfifo_publish.
+ *
+ * @param[in] shmfifo The handle
+ * @param[out] seq Sequence of the claimed record, to pass to shmfifo_publish
+ * @return Pointer to the record inside the shared memory
+ */
+void * shmfifo_claim(shmfifo_t * shmfifo, uint64_t * seq);
+
+/**
+ * @brief Makes a record claimed with shmfifo_claim visible to the consumers
+ *
+ * @param[in] shmfifo The handle
+ * @param[in] seq Sequence returned by shmfifo_claim
+ */
+void shmfifo_publish(shmfifo_t * shmfifo, uint64_t seq);
+
+/**
+ * @brief Returns the oldest record for @p consumer, blocking if there is none.
+ *        The record stays valid until shmfifo_release is called.
+ *
+ * @param[in] shmfifo The handle
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @return Pointer to the record inside the shared memory
+ */
+const void * shmfifo_read(shmfifo_t * shmfifo, uint32_t consumer);
+
+/**
+ * @brief Like shmfifo_read, but never blocks
+ *
+ * @param[in] shmfifo The handle
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ * @return Pointer to the record inside the shared memory, NULL if there is none
+ */
+const void * shmfifo_try_read(shmfifo_t * shmfifo, uint32_t consumer);
+
+/**
+ * @brief Removes the record returned by shmfifo_read for @p consumer from the FIFO
+ *
+ * @param[in] shmfifo The handle
+ * @param[in] consumer ID of the consumer (0 to consumers - 1)
+ */
+void shmfifo_release(shmfifo_t * shmfifo, uint32_t consumer);
+
+/**
+ * @brief Unmaps the shared FIFO from this process
+ *
+ * @param[in] shmfifo The handle
+ */
+void shmfifo_close(shmfifo_t * shmfifo);
+
+/**
+ * @brief Removes the shared memory object name. Processes that mapped it can keep
+ *        using it, the memory is released when the last one closes it.
+ *
+ * @param[in] name Shared memory object name
+ * @return 0, or -1 on error (see errno)
+ */
+int shmfifo_unlink(const char * name);
+
+/** @} */
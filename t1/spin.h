@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @defgroup spin Spin
+ * @brief Busy-wait helpers shared by the queues. Waits poll for a while with
+ *        spin_until before parking (see fifo_wait_until).
+ * @{
+ */
+
+/** @brief Default number of polls before parking */
+#define SPIN_POLLS 256
+
+/**
+ * @brief Condition polled by spin_until
+ *
+ * @param[in] arg Argument given to spin_until
+ * @return true once the wait is over
+ */
+typedef bool (*spin_ready_fn_t)(void * arg);
+
+/**
+ * @brief Tells the CPU the thread is busy-waiting (pause hint)
+ */
+static inline void spin_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/**
+ * @brief Polls @p ready up to @p polls times, with a pause hint between polls
+ *
+ * @param[in] ready Condition
+ * @param[in] arg Argument of ready
+ * @param[in] polls Maximum number of polls
+ * @return true if ready returned true
+ */
+static inline bool spin_until(spin_ready_fn_t ready, void * arg, uint32_t polls) {
+	for (uint32_t i=0; i<polls; i++) {
+		if (ready(arg))
+			return true;
+		spin_relax();
+	}
+	return false;
+}
+
+/** @} */
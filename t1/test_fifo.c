@@ -1,16 +1,24 @@
 #define _POSIX_C_SOURCE 199309L
 #include "fifo.h"
+#include "sfifo.h"
+#include "pfifo.h"
 #include "sem.h"
+#include "node.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <poll.h>
 
 #define FIFO_LEN       10
 #define ITERATIONS     50
 #define THREADS_PUSH   30
 #define THREADS_POP    20
 #define THREAD_COUNT   ((THREADS_POP) + (THREADS_PUSH))
+#define BATCH          7
+#define SELECT_FIFOS   3
 
 #define ERROR(...) do { printf(__VA_ARGS__); printf("Line: %d\n", __LINE__); } while (0);
 
@@ -18,6 +26,20 @@ pthread_t threads[THREAD_COUNT];
 pthread_attr_t attr;
 uint32_t id[THREAD_COUNT];
 fifo_t fifo;
+sfifo_t sfifo;
+pfifo_t pfifo;
+fifo_t select_fifos[SELECT_FIFOS];
+int consumer_fds[THREADS_POP];
+atomic_bool push_done;
+// Numbers pushed by push_sequence, and if it pauses now and then
+uint32_t sequence_count = ITERATIONS * THREADS_PUSH;
+bool sequence_delay = true;
+// Times each value was popped by a group, and total popped
+atomic_uint group_seen[THREADS_PUSH][ITERATIONS];
+atomic_uint group_popped;
+// Watermark changes seen, and if the last one was high
+atomic_uint watermark_changes;
+atomic_bool watermark_high;
 // Actual values used in the tests
 int test_threads_push;
 int test_threads_pop;
@@ -42,7 +64,7 @@ void * push(void * p) {
 	for (uint32_t i=0; i < ITERATIONS; i++) {
 		delay();
 		uint32_t tmp = (id << 16) | (i & UINT16_MAX);
-		fifo_push(&fifo, (void *)tmp);
+		fifo_push(&fifo, (void *)(uintptr_t)tmp);
 	}
 	printf("Push done %u\n", id);
 	return NULL;
@@ -60,8 +82,9 @@ void * pop(void * p) {
 
 	for (volatile uint32_t i=0; i < ITERATIONS * test_threads_push; i++) {
 		delay();
-		volatile uint32_t data = UINT32_MAX;
-		fifo_pop(&fifo, id, (void **)&data);
+		void * out = NULL;
+		fifo_pop(&fifo, id, &out);
+		uint32_t data = (uint32_t)(uintptr_t)out;
 		uint32_t push_thread = data >> 16;
 		uint32_t value = data & UINT16_MAX;
 		uint32_t expected = sem_signal(&counters[push_thread]);
@@ -78,13 +101,553 @@ void * pop(void * p) {
 	return NULL;
 }
 
+// Pushes numbers from 0 to ITERATIONS-1 in batches of up to BATCH
+void * push_batch(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start push batch %u\n", id);
+
+	void * batch[BATCH];
+	uint32_t i = 0;
+	while (i < ITERATIONS) {
+		delay();
+		uint32_t n = 1 + rand() % BATCH;
+		if (n > ITERATIONS - i)
+			n = ITERATIONS - i;
+		for (uint32_t k=0; k<n; k++, i++)
+			batch[k] = (void *)(uintptr_t)((id << 16) | (i & UINT16_MAX));
+		fifo_push_n(&fifo, batch, n);
+	}
+	printf("Push batch done %u\n", id);
+	return NULL;
+}
+
+void * pop_batch(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start pop batch %u\n", id);
+
+	uint32_t counters[THREADS_PUSH] = {0};
+	void * batch[BATCH];
+	uint32_t total = 0;
+	while (total < ITERATIONS * test_threads_push) {
+		delay();
+		uint32_t max = ITERATIONS * test_threads_push - total;
+		uint32_t n = fifo_pop_n(&fifo, id, batch, max < BATCH ? max : BATCH);
+		for (uint32_t k=0; k<n; k++) {
+			uint32_t data = (uint32_t)(uintptr_t)batch[k];
+			uint32_t push_thread = data >> 16;
+			uint32_t value = data & UINT16_MAX;
+			if (value != counters[push_thread]++) {
+				ERROR("Pop batch (%u): expected %u, got value %u, push id %u\n", id,
+				      counters[push_thread] - 1, value, push_thread);
+				test_failed();
+			}
+		}
+		total += n;
+	}
+
+	printf("Pop batch done %u\n", id);
+	return NULL;
+}
+
+typedef struct {
+	uint32_t producer;
+	uint32_t value;
+	char text[24];
+} record_t;
+
+// Writes records with values from 0 to ITERATIONS-1 in place
+void * push_record(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start push record %u\n", id);
+
+	for (uint32_t i=0; i < ITERATIONS; i++) {
+		delay();
+		fifo_seq_t seq;
+		record_t * r = (record_t *)fifo_claim(&fifo, &seq);
+		r->producer = id;
+		r->value = i;
+		snprintf(r->text, sizeof(r->text), "%u:%u", id, i);
+		fifo_publish(&fifo, seq);
+	}
+	printf("Push record done %u\n", id);
+	return NULL;
+}
+
+void * pop_record(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start pop record %u\n", id);
+
+	uint32_t counters[THREADS_PUSH] = {0};
+	for (uint32_t i=0; i < ITERATIONS * test_threads_push; i++) {
+		delay();
+		const record_t * r = (const record_t *)fifo_read(&fifo, id);
+		char text[sizeof(r->text)];
+		snprintf(text, sizeof(text), "%u:%u", r->producer, r->value);
+		if (r->value != counters[r->producer]++ || strcmp(text, r->text)) {
+			ERROR("Pop record (%u): expected %u, got value %u (%s), push id %u\n", id,
+			      counters[r->producer] - 1, r->value, r->text, r->producer);
+			test_failed();
+		}
+		fifo_release(&fifo, id);
+	}
+
+	printf("Pop record done %u\n", id);
+	return NULL;
+}
+
+// Pushes pool payloads with values from 0 to ITERATIONS-1
+void * push_payload(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start push payload %u\n", id);
+
+	for (uint32_t i=0; i < ITERATIONS; i++) {
+		delay();
+		uint32_t * payload = (uint32_t *)fifo_alloc(&fifo, 2 * sizeof(uint32_t));
+		payload[0] = id;
+		payload[1] = i;
+		fifo_push(&fifo, payload);
+	}
+	printf("Push payload done %u\n", id);
+	return NULL;
+}
+
+void * pop_payload(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start pop payload %u\n", id);
+
+	uint32_t counters[THREADS_PUSH] = {0};
+	for (uint32_t i=0; i < ITERATIONS * test_threads_push; i++) {
+		void * tmp;
+		fifo_pop(&fifo, id, &tmp);
+		uint32_t * payload = (uint32_t *)tmp;
+		uint32_t push_thread = payload[0];
+		uint32_t value = payload[1];
+		if (value != counters[push_thread]++) {
+			ERROR("Pop payload (%u): expected %u, got value %u, push id %u\n", id,
+			      counters[push_thread] - 1, value, push_thread);
+			test_failed();
+		}
+		// Still ours until the next pop
+		delay();
+		if (payload[0] != push_thread || payload[1] != value) {
+			ERROR("Pop payload (%u): payload freed while in use\n", id);
+			test_failed();
+		}
+	}
+
+	printf("Pop payload done %u\n", id);
+	return NULL;
+}
+
+// Pushes numbers from 0 to ITERATIONS-1 to the producer shard
+void * push_sharded(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start push sharded %u\n", id);
+
+	for (uint32_t i=0; i < ITERATIONS; i++) {
+		delay();
+		sfifo_push(&sfifo, id, (void *)(uintptr_t)((id << 16) | (i & UINT16_MAX)));
+	}
+	printf("Push sharded done %u\n", id);
+	return NULL;
+}
+
+void * pop_sharded(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start pop sharded %u\n", id);
+
+	uint32_t counters[THREADS_PUSH] = {0};
+	for (uint32_t i=0; i < ITERATIONS * test_threads_push; i++) {
+		delay();
+		void * out;
+		sfifo_pop(&sfifo, id, &out);
+		uint32_t data = (uint32_t)(uintptr_t)out;
+		uint32_t push_thread = data >> 16;
+		uint32_t value = data & UINT16_MAX;
+		if (value != counters[push_thread]++) {
+			ERROR("Pop sharded (%u): expected %u, got value %u, push id %u\n", id,
+			      counters[push_thread] - 1, value, push_thread);
+			test_failed();
+		}
+	}
+
+	printf("Pop sharded done %u\n", id);
+	return NULL;
+}
+
+// Absolute CLOCK_MONOTONIC time ms milliseconds from now
+static struct timespec deadline_in(long ms) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	t.tv_sec += ms / 1000;
+	t.tv_nsec += (ms % 1000) * 1000000;
+	if (t.tv_nsec >= 1000000000) {
+		t.tv_sec++;
+		t.tv_nsec -= 1000000000;
+	}
+	return t;
+}
+
+// Pushes numbers from 0 to ITERATIONS * THREADS_PUSH - 1
+void * push_sequence(void * p) {
+	printf("Start push sequence\n");
+	for (uint32_t i=0; i < sequence_count; i++) {
+		if (sequence_delay && i % 8 == 0)
+			delay();
+		fifo_push(&fifo, (void *)(uintptr_t)i);
+	}
+	atomic_store(&push_done, true);
+	printf("Push sequence done\n");
+	return NULL;
+}
+
+// Pops every number pushed by push_sequence, as consumer 0
+void * pop_sequence(void * p) {
+	printf("Start pop sequence\n");
+	for (uint32_t i=0; i < sequence_count; i++) {
+		void * tmp;
+		fifo_pop(&fifo, 0, &tmp);
+		if (tmp != (void *)(uintptr_t)i) {
+			ERROR("Pop sequence: expected %u, got %u\n", i, (uint32_t)(uintptr_t)tmp);
+			test_failed();
+		}
+	}
+	printf("Pop sequence done\n");
+	return NULL;
+}
+
+// Attaches, pops a few numbers, detaches and repeats until the producer is done
+void * pop_attached(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start pop attached %u\n", id);
+
+	uint32_t sessions = 0;
+	uint32_t last = 0;
+	bool popped = false;
+	while (!atomic_load(&push_done)) {
+		uint32_t consumer;
+		if (!fifo_attach(&fifo, &consumer)) {
+			delay();
+			continue;
+		}
+		sessions++;
+
+		uint32_t count = rand() % 20;
+		bool first = true;
+		for (uint32_t i=0; i<count; i++) {
+			void * tmp;
+			struct timespec t = deadline_in(10);
+			if (!fifo_timed_pop(&fifo, consumer, &tmp, &t))
+				break;
+			uint32_t value = (uint32_t)(uintptr_t)tmp;
+			// Consecutive within a session, only newer numbers after attaching again
+			if (popped && (first ? value <= last : value != last + 1)) {
+				ERROR("Pop attached (%u): got %u after %u\n", id, value, last);
+				test_failed();
+			}
+			last = value;
+			popped = true;
+			first = false;
+		}
+		fifo_detach(&fifo, consumer);
+		// Give the other threads a chance to take the ID
+		delay();
+	}
+
+	printf("Pop attached done %u (%u sessions)\n", id, sessions);
+	return NULL;
+}
+
+// Pops until the producers are done, slower than they push, so some values are lost
+void * pop_lossy(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start pop lossy %u\n", id);
+
+	// Values of each producer only increase, with gaps when lapped
+	int64_t last[THREADS_PUSH];
+	for (int i=0; i<THREADS_PUSH; i++)
+		last[i] = -1;
+
+	uint32_t popped = 0;
+	for (;;) {
+		void * tmp;
+		struct timespec t = deadline_in(10);
+		if (!fifo_timed_pop(&fifo, id, &tmp, &t)) {
+			if (atomic_load(&push_done))
+				break;
+			continue;
+		}
+		uint32_t data = (uint32_t)(uintptr_t)tmp;
+		uint32_t push_thread = data >> 16;
+		uint32_t value = data & UINT16_MAX;
+		if ((int64_t)value <= last[push_thread]) {
+			ERROR("Pop lossy (%u): got %u after %lld, push id %u\n", id, value,
+			      (long long)last[push_thread], push_thread);
+			test_failed();
+		}
+		last[push_thread] = value;
+		popped++;
+		delay();
+		delay();
+	}
+
+	fifo_seq_t lost = fifo_lost(&fifo, id);
+	if (popped + lost != ITERATIONS * test_threads_push) {
+		ERROR("Pop lossy (%u): popped %u, lost %llu\n", id, popped,
+		      (unsigned long long)lost);
+		test_failed();
+	}
+	printf("Pop lossy done %u (lost %llu)\n", id, (unsigned long long)lost);
+	return NULL;
+}
+
+// Member of the group with consumer ID 1, takes its share of the values
+void * pop_group(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start pop group %u\n", id);
+
+	// Each member still gets the values of each producer in order
+	int64_t last[THREADS_PUSH];
+	for (int i=0; i<THREADS_PUSH; i++)
+		last[i] = -1;
+
+	uint32_t popped = 0;
+	while (atomic_load(&group_popped) < ITERATIONS * test_threads_push) {
+		void * tmp;
+		struct timespec t = deadline_in(10);
+		if (!fifo_timed_pop(&fifo, 1, &tmp, &t))
+			continue;
+		uint32_t data = (uint32_t)(uintptr_t)tmp;
+		uint32_t push_thread = data >> 16;
+		uint32_t value = data & UINT16_MAX;
+		if ((int64_t)value <= last[push_thread]) {
+			ERROR("Pop group (%u): got %u after %lld, push id %u\n", id, value,
+			      (long long)last[push_thread], push_thread);
+			test_failed();
+		}
+		last[push_thread] = value;
+		atomic_fetch_add(&group_seen[push_thread][value], 1);
+		atomic_fetch_add(&group_popped, 1);
+		popped++;
+		delay();
+	}
+
+	printf("Pop group done %u (%u popped)\n", id, popped);
+	return NULL;
+}
+
+// Pushes numbers from 0 to ITERATIONS-1 to select_fifos[id]
+void * push_select(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start push select %u\n", id);
+
+	for (uint32_t i=0; i < ITERATIONS; i++) {
+		delay();
+		fifo_push(&select_fifos[id], (void *)(uintptr_t)i);
+	}
+	printf("Push select done %u\n", id);
+	return NULL;
+}
+
+// Pops everything from select_fifos[id] as consumer 0
+void * pop_single_fifo(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	for (uint32_t i=0; i < ITERATIONS; i++) {
+		void * tmp;
+		delay();
+		fifo_pop(&select_fifos[id], 0, &tmp);
+		if (tmp != (void *)(uintptr_t)i) {
+			ERROR("Pop single FIFO (%u): expected %u, got %u\n", id, i,
+			      (uint32_t)(uintptr_t)tmp);
+			test_failed();
+		}
+	}
+	return NULL;
+}
+
+// Pops everything from all select_fifos as consumer 1, from one thread
+void * pop_select(void * p) {
+	printf("Start pop select\n");
+	fifo_source_t sources[SELECT_FIFOS];
+	for (int i=0; i<SELECT_FIFOS; i++) {
+		sources[i].fifo = &select_fifos[i];
+		sources[i].consumer = 1;
+	}
+	fifo_selector_t sel;
+	fifo_selector_init(&sel, sources, SELECT_FIFOS);
+
+	uint32_t counters[SELECT_FIFOS] = {0};
+	for (uint32_t i=0; i < ITERATIONS * SELECT_FIFOS; i++) {
+		int k = fifo_select(&sel, NULL);
+		void * tmp;
+		if (k < 0 || !fifo_try_pop(&select_fifos[k], 1, &tmp)) {
+			ERROR("Pop select: source %d not ready\n", k);
+			test_failed();
+		}
+		if (tmp != (void *)(uintptr_t)counters[k]++) {
+			ERROR("Pop select: expected %u, got %u from %d\n", counters[k] - 1,
+			      (uint32_t)(uintptr_t)tmp, k);
+			test_failed();
+		}
+	}
+
+	// All consumed
+	struct timespec t = deadline_in(20);
+	if (fifo_select(&sel, &t) != -1) test_failed();
+
+	fifo_selector_destroy(&sel);
+	printf("Pop select done\n");
+	return NULL;
+}
+
+// True if fd is signaled, resets it
+static bool fd_signaled(int fd) {
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint64_t count;
+	if (poll(&pfd, 1, 0) != 1)
+		return false;
+	return read(fd, &count, sizeof(count)) == sizeof(count);
+}
+
+// Event loop style consumer: waits on its eventfd and drains the FIFO
+void * pop_fd(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start pop fd %u\n", id);
+	int fd = consumer_fds[id];
+
+	uint32_t counters[THREADS_PUSH] = {0};
+	uint32_t popped = 0;
+	uint32_t wakeups = 0;
+	while (popped < ITERATIONS * test_threads_push) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		if (poll(&pfd, 1, 1000) != 1) {
+			ERROR("Pop fd (%u): not signaled, %u popped\n", id, popped);
+			test_failed();
+		}
+		uint64_t count;
+		if (read(fd, &count, sizeof(count)) != sizeof(count)) test_failed();
+		wakeups++;
+
+		void * out[BATCH];
+		uint32_t n;
+		while ((n = fifo_try_pop_n(&fifo, id, out, BATCH))) {
+			for (uint32_t i=0; i<n; i++) {
+				uint32_t data = (uint32_t)(uintptr_t)out[i];
+				uint32_t push_thread = data >> 16;
+				uint32_t value = data & UINT16_MAX;
+				if (value != counters[push_thread]++) {
+					ERROR("Pop fd (%u): expected %u, got value %u, push id %u\n", id,
+					      counters[push_thread] - 1, value, push_thread);
+					test_failed();
+				}
+			}
+			popped += n;
+		}
+	}
+
+	printf("Pop fd done %u (%u wakeups)\n", id, wakeups);
+	return NULL;
+}
+
+// Pushes numbers from 0 to ITERATIONS-1 to the bulk lane (1), or to the control
+// lane (0) for the last thread
+void * push_priority(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	uint32_t lane = id == (uint32_t)test_threads_push - 1 ? 0 : 1;
+	printf("Start push priority %u (lane %u)\n", id, lane);
+
+	for (uint32_t i=0; i < ITERATIONS; i++) {
+		if (lane == 0)
+			delay();
+		pfifo_push(&pfifo, lane, (void *)(uintptr_t)((id << 16) | (i & UINT16_MAX)));
+	}
+	printf("Push priority done %u\n", id);
+	return NULL;
+}
+
+void * pop_priority(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start pop priority %u\n", id);
+
+	uint32_t counters[THREADS_PUSH] = {0};
+	for (uint32_t i=0; i < ITERATIONS * test_threads_push; i++) {
+		delay();
+		void * out;
+		uint32_t lane = pfifo_pop(&pfifo, id, &out);
+		uint32_t data = (uint32_t)(uintptr_t)out;
+		uint32_t push_thread = data >> 16;
+		uint32_t value = data & UINT16_MAX;
+		bool control = push_thread == (uint32_t)test_threads_push - 1;
+		if (lane != (control ? 0 : 1) || value != counters[push_thread]++) {
+			ERROR("Pop priority (%u): expected %u, got value %u, push id %u, lane %u\n",
+			      id, counters[push_thread] - 1, value, push_thread, lane);
+			test_failed();
+		}
+	}
+
+	printf("Pop priority done %u\n", id);
+	return NULL;
+}
+
+// Pushes numbers from 0 to ITERATIONS-1 in reserved bursts of up to BATCH, slowing
+// down while the FIFO is congested
+void * push_reserved(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start push reserved %u\n", id);
+
+	uint32_t i = 0;
+	while (i < ITERATIONS) {
+		delay();
+		if (fifo_congested(&fifo))
+			delay();
+		uint32_t n = 1 + rand() % BATCH;
+		if (n > ITERATIONS - i)
+			n = ITERATIONS - i;
+		fifo_credit_t credit;
+		if (!fifo_reserve(&fifo, n, &credit)) {
+			ERROR("Push reserved (%u): reserve %u failed\n", id, n);
+			test_failed();
+		}
+		for (uint32_t k=0; k<n; k++, i++)
+			fifo_push_credit(&fifo, &credit, (void *)(uintptr_t)((id << 16) | i));
+	}
+	printf("Push reserved done %u\n", id);
+	return NULL;
+}
+
+void on_watermark(void * arg, bool high) {
+	if (atomic_load(&watermark_high) == high) {
+		ERROR("Watermark: %s twice\n", high ? "high" : "low");
+		test_failed();
+	}
+	atomic_store(&watermark_high, high);
+	atomic_fetch_add(&watermark_changes, 1);
+}
+
+// Resizes the FIFO to random lengths until the producers are done. At least 2,
+// as consumers keep their last pool payload.
+void * resize(void * p) {
+	printf("Start resize\n");
+	uint32_t resizes = 0;
+	while (!atomic_load(&push_done)) {
+		delay();
+		if (!fifo_resize(&fifo, 2 + rand() % (2 * FIFO_LEN))) {
+			ERROR("Resize failed\n");
+			test_failed();
+		}
+		resizes++;
+	}
+	printf("Resize done (%u resizes)\n", resizes);
+	return NULL;
+}
+
 void test_single_threaded(void) {
 	fifo_init(&fifo, 10, 3);
 	fifo_clear(&fifo);
 
 	printf("Test single threaded\n");
 	for (uint32_t i=0; i<10; i++)
-		fifo_push(&fifo, (void *)i);
+		fifo_push(&fifo, (void *)(uintptr_t)i);
 
 	void * tmp;
 	for (int i=0; i<3; i++) {
@@ -97,22 +660,61 @@ void test_single_threaded(void) {
 	for (uint32_t i=1; i<11; i++) {
 		for (int k=0; k<3; k++) {
 			fifo_pop(&fifo, k, &tmp);
-			if (tmp != (void*)i) test_failed();
+			if (tmp != (void*)(uintptr_t)i) test_failed();
+		}
+	}
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_try_timed(void) {
+	fifo_init(&fifo, FIFO_LEN, 2);
+
+	printf("Test try / timed\n");
+	void * tmp;
+	struct timespec t = deadline_in(20);
+	if (fifo_try_pop(&fifo, 0, &tmp)) test_failed();
+	if (fifo_timed_pop(&fifo, 0, &tmp, &t)) test_failed();
+
+	for (uint32_t i=0; i<FIFO_LEN; i++)
+		if (!fifo_try_push(&fifo, (void *)(uintptr_t)i)) test_failed();
+
+	t = deadline_in(20);
+	if (fifo_try_push(&fifo, (void *)FIFO_LEN)) test_failed();
+	if (fifo_timed_push(&fifo, (void *)FIFO_LEN, &t)) test_failed();
+
+	// Space is only available after both consumers pop
+	if (!fifo_try_pop(&fifo, 0, &tmp) || tmp != (void *)0) test_failed();
+	if (fifo_try_push(&fifo, (void *)FIFO_LEN)) test_failed();
+	t = deadline_in(20);
+	if (!fifo_timed_pop(&fifo, 1, &tmp, &t) || tmp != (void *)0) test_failed();
+	t = deadline_in(20);
+	if (!fifo_timed_push(&fifo, (void *)FIFO_LEN, &t)) test_failed();
+
+	for (uint32_t i=1; i<=FIFO_LEN; i++) {
+		for (int k=0; k<2; k++) {
+			if (!fifo_try_pop(&fifo, k, &tmp)) test_failed();
+			if (tmp != (void *)(uintptr_t)i) test_failed();
 		}
 	}
+	if (fifo_try_pop(&fifo, 1, &tmp)) test_failed();
+
 	fifo_destroy(&fifo);
 	printf("Done.\n");
 }
 
-void test_single_push(void) {
+void test_single_push(bool single_producer) {
 	test_threads_pop = THREADS_POP;
 	test_threads_push = 1;
 	test_threads_count = 1 + THREADS_POP;
 
-	fifo_init(&fifo, FIFO_LEN, test_threads_pop);
+	fifo_config_t config = { .length = FIFO_LEN, .consumers = test_threads_pop,
+	                         .single_producer = single_producer };
+	fifo_init_config(&fifo, &config);
 	fifo_clear(&fifo);
 
-	printf("Test 1 push, %u pop\n", test_threads_pop);
+	printf("Test 1 push%s, %u pop\n", single_producer ? " (single producer)" : "",
+	       test_threads_pop);
 	for (int i=0; i<test_threads_pop; i++)
 		pthread_create(&threads[i], &attr, pop, &id[i]);
 
@@ -172,20 +774,899 @@ void test_multiple(void) {
 	printf("Done.\n");
 }
 
-int main() {
-	srand(time(NULL));
+void test_batch(void) {
+	test_threads_pop = THREADS_POP;
+	test_threads_push = THREADS_PUSH;
+	test_threads_count = THREADS_POP + THREADS_PUSH;
 
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+	fifo_init(&fifo, FIFO_LEN, test_threads_pop);
 
-	for (int i=0; i<THREAD_COUNT; i++)
-		id[i] = i;
+	printf("Test batch %u pop, %u push\n", test_threads_pop, test_threads_push);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push_batch, &id[i]);
 
-	test_single_threaded();
-	test_single_push();
-	test_single_pop();
-	test_multiple();
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop_batch, &id[i]);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_records(void) {
+	test_threads_pop = THREADS_POP;
+	test_threads_push = THREADS_PUSH;
+	test_threads_count = THREADS_POP + THREADS_PUSH;
+
+	fifo_init_records(&fifo, FIFO_LEN, test_threads_pop, sizeof(record_t));
+
+	printf("Test records %u pop, %u push\n", test_threads_pop, test_threads_push);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push_record, &id[i]);
+
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop_record, &id[i]);
 
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_pool(void) {
+	test_threads_pop = THREADS_POP;
+	test_threads_push = THREADS_PUSH;
+	test_threads_count = THREADS_POP + THREADS_PUSH;
+
+	pool_t pool;
+	pool_init(&pool);
+	fifo_init(&fifo, FIFO_LEN, test_threads_pop);
+	fifo_set_pool(&fifo, &pool);
+
+	printf("Test pool %u pop, %u push\n", test_threads_pop, test_threads_push);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push_payload, &id[i]);
+
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop_payload, &id[i]);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	fifo_destroy(&fifo);
+	pool_destroy(&pool);
+	printf("Done.\n");
+}
+
+void test_wait_strategies(void) {
+	test_threads_pop = 4;
+	test_threads_push = 4;
+	test_threads_count = test_threads_pop + test_threads_push;
+
+	// Producers spin, each consumer uses a different strategy
+	fifo_config_t config = { .length = FIFO_LEN, .consumers = test_threads_pop,
+	                         .wait = FIFO_WAIT_SPIN };
+	fifo_init_config(&fifo, &config);
+	fifo_set_consumer_wait(&fifo, 0, FIFO_WAIT_HYBRID);
+	fifo_set_consumer_wait(&fifo, 1, FIFO_WAIT_SPIN);
+	fifo_set_consumer_wait(&fifo, 2, FIFO_WAIT_YIELD);
+	fifo_set_consumer_wait(&fifo, 3, FIFO_WAIT_BLOCK);
+
+	printf("Test wait strategies %u pop, %u push\n", test_threads_pop, test_threads_push);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push, &id[i]);
+
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop, &id[i]);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_attach_single_threaded(void) {
+	fifo_config_t config = { .length = 4, .consumers = 1, .max_consumers = 3 };
+	fifo_init_config(&fifo, &config);
+
+	printf("Test attach / detach single threaded\n");
+	void * tmp;
+	uint32_t a, b, c;
+	fifo_push(&fifo, (void *)1);
+	if (!fifo_attach(&fifo, &a) || !fifo_attach(&fifo, &b)) test_failed();
+	if (a == 0 || b == 0 || a == b) test_failed();
+	if (fifo_attach(&fifo, &c)) test_failed();
+
+	// New consumers only see what is pushed after they attach
+	if (fifo_try_pop(&fifo, a, &tmp)) test_failed();
+	fifo_push(&fifo, (void *)2);
+	if (!fifo_try_pop(&fifo, a, &tmp) || tmp != (void *)2) test_failed();
+
+	// b never pops: full until it detaches
+	for (uintptr_t i=1; i<=5; i++) {
+		if (i >= 3)
+			fifo_push(&fifo, (void *)i);
+		if (!fifo_try_pop(&fifo, 0, &tmp) || tmp != (void *)i) test_failed();
+	}
+	for (uintptr_t i=3; i<=5; i++)
+		if (!fifo_try_pop(&fifo, a, &tmp) || tmp != (void *)i) test_failed();
+	if (fifo_try_push(&fifo, (void *)6)) test_failed();
+	fifo_detach(&fifo, b);
+	if (!fifo_try_push(&fifo, (void *)6)) test_failed();
+
+	// The ID is reused
+	if (!fifo_attach(&fifo, &c) || c != b) test_failed();
+	fifo_push(&fifo, (void *)7);
+	if (!fifo_try_pop(&fifo, c, &tmp) || tmp != (void *)7) test_failed();
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_attach(void) {
+	test_threads_pop = 4;
+	test_threads_push = 1;
+	test_threads_count = test_threads_pop + 2;
+
+	// One consumer from the start, the others compete for 2 more IDs
+	fifo_config_t config = { .length = FIFO_LEN, .consumers = 1, .max_consumers = 3 };
+	fifo_init_config(&fifo, &config);
+	atomic_store(&push_done, false);
+
+	printf("Test attach / detach %u pop\n", test_threads_pop);
+	pthread_create(&threads[0], &attr, pop_sequence, &id[0]);
+	for (int i=1; i<=test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop_attached, &id[i]);
+	pthread_create(&threads[test_threads_pop + 1], &attr, push_sequence, NULL);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+// Attaches, pops more than a FIFO length, detaches, and repeats without pausing
+void * attach_loop(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	uint32_t sessions = 0;
+	uint32_t last = 0;
+	bool popped = false;
+	while (!atomic_load(&push_done)) {
+		uint32_t consumer;
+		if (!fifo_attach(&fifo, &consumer)) {
+			sched_yield();
+			continue;
+		}
+		sessions++;
+
+		// If the producer overwrote positions this consumer was about to read,
+		// it gets newer numbers first and then older ones
+		for (uint32_t i=0; i<2 * fifo_length(&fifo) + 1; i++) {
+			void * tmp;
+			struct timespec t = deadline_in(1);
+			if (!fifo_timed_pop(&fifo, consumer, &tmp, &t))
+				break;
+			uint32_t value = (uint32_t)(uintptr_t)tmp;
+			if (popped && (i ? value != last + 1 : value <= last)) {
+				ERROR("Attach loop (%u): got %u after %u\n", id, value, last);
+				test_failed();
+			}
+			last = value;
+			popped = true;
+		}
+		fifo_detach(&fifo, consumer);
+	}
+	printf("Attach loop %u done, %u sessions\n", id, sessions);
+	return NULL;
+}
+
+void test_attach_race(void) {
+	test_threads_pop = 6;
+	test_threads_count = test_threads_pop + 2;
+
+	// Room for every attacher, so they attach at the same time as often as possible
+	fifo_config_t config = { .length = 4, .consumers = 1,
+	                         .max_consumers = test_threads_pop + 1 };
+	fifo_init_config(&fifo, &config);
+	atomic_store(&push_done, false);
+	sequence_count = 200000;
+	sequence_delay = false;
+
+	printf("Test concurrent attaches %u threads\n", test_threads_pop);
+	pthread_create(&threads[0], &attr, pop_sequence, &id[0]);
+	for (int i=1; i<=test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, attach_loop, &id[i]);
+	pthread_create(&threads[test_threads_pop + 1], &attr, push_sequence, NULL);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	sequence_count = ITERATIONS * THREADS_PUSH;
+	sequence_delay = true;
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_overwrite_single_threaded(void) {
+	fifo_config_t config = { .length = 4, .consumers = 2, .overwrite = true };
+	fifo_init_config(&fifo, &config);
+
+	printf("Test overwrite single threaded\n");
+	void * tmp;
+	for (uintptr_t i=0; i<10; i++)
+		if (!fifo_try_push(&fifo, (void *)i)) test_failed();
+
+	// Lapped: skips to the oldest pointer left
+	if (fifo_pop(&fifo, 0, &tmp) != 6 || tmp != (void *)6) test_failed();
+	for (uintptr_t i=7; i<10; i++)
+		if (fifo_pop(&fifo, 0, &tmp) != 0 || tmp != (void *)i) test_failed();
+	if (fifo_try_pop(&fifo, 0, &tmp)) test_failed();
+	if (fifo_lost(&fifo, 0) != 6) test_failed();
+
+	// Batches skip too, and stop at the end
+	void * out[8];
+	fifo_push(&fifo, (void *)10);
+	if (fifo_pop_n(&fifo, 1, out, 8) != 4) test_failed();
+	for (uintptr_t i=0; i<4; i++)
+		if (out[i] != (void *)(7 + i)) test_failed();
+	if (fifo_lost(&fifo, 1) != 7) test_failed();
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_overwrite(void) {
+	test_threads_pop = 4;
+	test_threads_push = 4;
+	test_threads_count = test_threads_pop + test_threads_push;
+
+	fifo_config_t config = { .length = FIFO_LEN, .consumers = test_threads_pop,
+	                         .overwrite = true };
+	fifo_init_config(&fifo, &config);
+	atomic_store(&push_done, false);
+
+	printf("Test overwrite %u pop, %u push\n", test_threads_pop, test_threads_push);
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop_lossy, &id[i]);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push, &id[i]);
+
+	for (int i=test_threads_pop; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+	atomic_store(&push_done, true);
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_join(threads[i], NULL);
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_group_single_threaded(void) {
+	fifo_init(&fifo, 4, 2);
+	fifo_set_group(&fifo, 1);
+
+	printf("Test group single threaded\n");
+	void * tmp;
+	void * out[4];
+	for (uintptr_t i=0; i<4; i++)
+		fifo_push(&fifo, (void *)i);
+
+	// Any pop through the group ID moves the shared cursor
+	if (fifo_pop(&fifo, 1, &tmp) != 0 || tmp != (void *)0) test_failed();
+	if (!fifo_try_pop(&fifo, 1, &tmp) || tmp != (void *)1) test_failed();
+	if (fifo_pop_n(&fifo, 1, out, 4) != 2) test_failed();
+	if (out[0] != (void *)2 || out[1] != (void *)3) test_failed();
+	if (fifo_try_pop(&fifo, 1, &tmp)) test_failed();
+
+	// Space is only available after the broadcast consumer pops too
+	if (fifo_try_push(&fifo, (void *)4)) test_failed();
+	if (!fifo_try_pop(&fifo, 0, &tmp) || tmp != (void *)0) test_failed();
+	if (!fifo_try_push(&fifo, (void *)4)) test_failed();
+	if (!fifo_try_pop(&fifo, 1, &tmp) || tmp != (void *)4) test_failed();
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_group(void) {
+	uint32_t members = 4;
+	test_threads_pop = 1 + members;
+	test_threads_push = 4;
+	test_threads_count = test_threads_pop + test_threads_push;
+
+	// Consumer 0 gets every value, the members of group 1 share them
+	fifo_init(&fifo, FIFO_LEN, 2);
+	fifo_set_group(&fifo, 1);
+	memset(group_seen, 0, sizeof(group_seen));
+	atomic_store(&group_popped, 0);
+
+	printf("Test group 1 + %u pop, %u push\n", members, test_threads_push);
+	pthread_create(&threads[0], &attr, pop, &id[0]);
+	for (uint32_t i=1; i<=members; i++)
+		pthread_create(&threads[i], &attr, pop_group, &id[i]);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push, &id[i]);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	for (int i=0; i<test_threads_push; i++) {
+		for (int k=0; k<ITERATIONS; k++) {
+			if (group_seen[i][k] != 1) {
+				ERROR("Group: push id %d value %d popped %u times\n", i, k,
+				      group_seen[i][k]);
+				test_failed();
+			}
+		}
+	}
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_select(void) {
+	test_threads_pop = 1 + SELECT_FIFOS;
+	test_threads_push = SELECT_FIFOS;
+	test_threads_count = test_threads_pop + test_threads_push;
+
+	// Consumer 0 of each FIFO has its own thread, consumer 1 of all of them shares one
+	for (int i=0; i<SELECT_FIFOS; i++)
+		fifo_init(&select_fifos[i], FIFO_LEN, 2);
+
+	printf("Test select %u FIFOs\n", SELECT_FIFOS);
+	pthread_create(&threads[0], &attr, pop_select, NULL);
+	for (int i=0; i<SELECT_FIFOS; i++) {
+		pthread_create(&threads[1 + i], &attr, pop_single_fifo, &id[i]);
+		pthread_create(&threads[test_threads_pop + i], &attr, push_select, &id[i]);
+	}
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	for (int i=0; i<SELECT_FIFOS; i++)
+		fifo_destroy(&select_fifos[i]);
+	printf("Done.\n");
+}
+
+void test_fd_single_threaded(void) {
+	fifo_init(&fifo, 4, 1);
+
+	printf("Test eventfd single threaded\n");
+	int fd = fifo_consumer_fd(&fifo, 0);
+	int space = fifo_space_fd(&fifo);
+	if (fd < 0 || space < 0) test_failed();
+	if (fd_signaled(fd)) test_failed();
+	// Armed while empty, so publishing only scans consumers then
+	if (atomic_load(&fifo.armed_fds) != 1) test_failed();
+
+	// Only the push that makes it non-empty signals
+	void * out[4];
+	fifo_push(&fifo, (void *)0);
+	if (!fd_signaled(fd) || atomic_load(&fifo.armed_fds)) test_failed();
+	fifo_push(&fifo, (void *)1);
+	if (fd_signaled(fd)) test_failed();
+	if (fifo_try_pop_n(&fifo, 0, out, 4) != 2 || out[1] != (void *)1) test_failed();
+	if (fd_signaled(fd)) test_failed();
+	if (fifo_try_pop_n(&fifo, 0, out, 4) != 0) test_failed();
+	if (atomic_load(&fifo.armed_fds) != 1) test_failed();
+	fifo_push(&fifo, (void *)2);
+	if (!fd_signaled(fd)) test_failed();
+
+	// Space is signaled after a push found it full
+	for (uintptr_t i=3; i<6; i++)
+		fifo_push(&fifo, (void *)i);
+	if (fd_signaled(space)) test_failed();
+	if (fifo_try_push(&fifo, (void *)6)) test_failed();
+	if (fd_signaled(space)) test_failed();
+	if (!fifo_try_pop(&fifo, 0, out) || out[0] != (void *)2) test_failed();
+	if (!fd_signaled(space)) test_failed();
+	if (!fifo_try_push(&fifo, (void *)6)) test_failed();
+	fifo_destroy(&fifo);
+
+	// A new eventfd on a FIFO with data is signaled right away and not left armed
+	fifo_init(&fifo, 4, 1);
+	fifo_push(&fifo, (void *)0);
+	fd = fifo_consumer_fd(&fifo, 0);
+	if (!fd_signaled(fd) || atomic_load(&fifo.armed_fds)) test_failed();
+	if (!fifo_try_pop(&fifo, 0, out)) test_failed();
+	fifo_push(&fifo, (void *)1);
+	if (fd_signaled(fd)) test_failed();
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_fd(void) {
+	test_threads_pop = 2;
+	test_threads_push = 4;
+	test_threads_count = test_threads_pop + test_threads_push;
+
+	fifo_init(&fifo, FIFO_LEN, test_threads_pop);
+	for (int i=0; i<test_threads_pop; i++)
+		if ((consumer_fds[i] = fifo_consumer_fd(&fifo, i)) < 0) test_failed();
+
+	printf("Test eventfd %u pop, %u push\n", test_threads_pop, test_threads_push);
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop_fd, &id[i]);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push, &id[i]);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_priority_single_threaded(void) {
+	uint32_t lengths[] = {2, 3};
+	pfifo_init(&pfifo, 2, lengths, 1);
+
+	printf("Test priority single threaded\n");
+	void * tmp;
+	uint32_t lane;
+	for (uintptr_t i=0; i<3; i++)
+		pfifo_push(&pfifo, 1, (void *)i);
+	if (pfifo_try_push(&pfifo, 1, (void *)3)) test_failed();
+
+	// The control lane still has space while bulk is full, and goes first
+	pfifo_push(&pfifo, 0, (void *)10);
+	if (pfifo_pop(&pfifo, 0, &tmp) != 0 || tmp != (void *)10) test_failed();
+	if (pfifo_pop(&pfifo, 0, &tmp) != 1 || tmp != (void *)0) test_failed();
+	pfifo_push(&pfifo, 0, (void *)11);
+	pfifo_push(&pfifo, 0, (void *)12);
+	if (pfifo_try_push(&pfifo, 0, (void *)13)) test_failed();
+	for (uintptr_t i=11; i<13; i++)
+		if (!pfifo_try_pop(&pfifo, 0, &tmp, &lane) || lane != 0 || tmp != (void *)i)
+			test_failed();
+	for (uintptr_t i=1; i<3; i++)
+		if (!pfifo_try_pop(&pfifo, 0, &tmp, &lane) || lane != 1 || tmp != (void *)i)
+			test_failed();
+	if (pfifo_try_pop(&pfifo, 0, &tmp, NULL)) test_failed();
+
+	pfifo_destroy(&pfifo);
+	printf("Done.\n");
+}
+
+void test_priority(void) {
+	test_threads_pop = 4;
+	test_threads_push = 5;
+	test_threads_count = test_threads_pop + test_threads_push;
+
+	// Bulk producers keep their lane full, the control producer is the last one
+	uint32_t lengths[] = {4, FIFO_LEN};
+	pfifo_init(&pfifo, 2, lengths, test_threads_pop);
+
+	printf("Test priority %u pop, %u push\n", test_threads_pop, test_threads_push);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push_priority, &id[i]);
+
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop_priority, &id[i]);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	pfifo_destroy(&pfifo);
+	printf("Done.\n");
+}
+
+void test_sharded(uint32_t shards) {
+	test_threads_pop = THREADS_POP;
+	test_threads_push = THREADS_PUSH;
+	test_threads_count = THREADS_POP + THREADS_PUSH;
+
+	sfifo_init(&sfifo, FIFO_LEN, test_threads_pop, test_threads_push, shards);
+
+	printf("Test sharded (%u shards) %u pop, %u push\n", shards, test_threads_pop,
+	       test_threads_push);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push_sharded, &id[i]);
+
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop_sharded, &id[i]);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	sfifo_destroy(&sfifo);
+	printf("Done.\n");
+}
+
+static uint64_t histogram_total(const uint64_t * histogram) {
+	uint64_t total = 0;
+	for (int i=0; i<FIFO_STATS_BUCKETS; i++)
+		total += histogram[i];
+	return total;
+}
+
+void test_stats_single_threaded(void) {
+	fifo_init(&fifo, 4, 2);
+
+	printf("Test stats single threaded\n");
+	fifo_stats_t stats;
+	fifo_consumer_stats_t consumers[2];
+	void * tmp;
+	void * batch[8];
+	for (uint32_t i=0; i<4; i++)
+		fifo_push(&fifo, (void *)(uintptr_t)i);
+	if (fifo_try_push(&fifo, (void *)4)) test_failed();
+	for (uint32_t i=0; i<4; i++)
+		fifo_pop(&fifo, 0, &tmp);
+	if (fifo_try_pop(&fifo, 0, &tmp)) test_failed();
+	if (fifo_pop_n(&fifo, 1, batch, 8) != 4) test_failed();
+
+	if (!fifo_stats(&fifo, &stats, consumers)) {
+		// Built without FIFO_STATS: nothing is counted
+		if (stats.push_calls || stats.pop_calls || consumers[0].popped) test_failed();
+		fifo_destroy(&fifo);
+		printf("Done (not built with FIFO_STATS).\n");
+		return;
+	}
+
+	if (stats.push_calls != 5 || stats.pushed != 4 || stats.blocked_pushes) test_failed();
+	if (stats.pop_calls != 6 || stats.popped != 8 || stats.blocked_pops) test_failed();
+	if (consumers[0].pop_calls != 5 || consumers[0].popped != 4) test_failed();
+	if (consumers[1].pop_calls != 1 || consumers[1].popped != 4) test_failed();
+	// Only the first push and pop of the thread are sampled: one position in use
+	// (bucket 1), and consumer 0 popping with 4 pointers pushed (bucket 3)
+	if (histogram_total(stats.occupancy) != 1 || stats.occupancy[1] != 1) test_failed();
+	if (histogram_total(consumers[0].lag) != 1 || consumers[0].lag[3] != 1) test_failed();
+	if (histogram_total(consumers[1].lag) != 0) test_failed();
+	if (histogram_total(stats.latency_ns) != 2) test_failed();
+
+	// A blocked pop waits until the push
+	struct timespec t = deadline_in(10);
+	if (fifo_timed_pop(&fifo, 0, &tmp, &t)) test_failed();
+	fifo_stats(&fifo, &stats, consumers);
+	if (consumers[0].blocked_pops != 1 || consumers[0].wait_ns < 10000000) test_failed();
+	if (consumers[0].pop_calls != 6 || consumers[0].popped != 4) test_failed();
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_stats(void) {
+	test_threads_pop = THREADS_POP;
+	test_threads_push = THREADS_PUSH;
+	test_threads_count = THREADS_POP + THREADS_PUSH;
+
+	fifo_init(&fifo, FIFO_LEN, test_threads_pop);
+
+	printf("Test stats %u pop, %u push\n", test_threads_pop, test_threads_push);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push, &id[i]);
+
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop, &id[i]);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	fifo_stats_t stats;
+	fifo_consumer_stats_t consumers[THREADS_POP];
+	if (fifo_stats(&fifo, &stats, consumers)) {
+		uint64_t total = ITERATIONS * THREADS_PUSH;
+		if (stats.push_calls != total || stats.pushed != total) test_failed();
+		if (stats.popped != total * THREADS_POP) test_failed();
+		if (!histogram_total(stats.occupancy) || !histogram_total(stats.latency_ns))
+			test_failed();
+		for (int i=0; i<test_threads_pop; i++) {
+			if (consumers[i].pop_calls != total || consumers[i].popped != total
+			    || !histogram_total(consumers[i].lag)) {
+				ERROR("Stats of consumer %d: %llu calls, %llu popped\n", i,
+				      (unsigned long long)consumers[i].pop_calls,
+				      (unsigned long long)consumers[i].popped);
+				test_failed();
+			}
+		}
+		printf("Blocked pushes %llu (%llu us), blocked pops %llu (%llu us)\n",
+		       (unsigned long long)stats.blocked_pushes,
+		       (unsigned long long)stats.push_wait_ns / 1000,
+		       (unsigned long long)stats.blocked_pops,
+		       (unsigned long long)stats.pop_wait_ns / 1000);
+	}
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_resize_single_threaded(void) {
+	fifo_init(&fifo, 4, 2);
+
+	printf("Test resize single threaded\n");
+	void * tmp;
+	for (uintptr_t i=1; i<=4; i++)
+		if (!fifo_try_push(&fifo, (void *)i)) test_failed();
+	if (fifo_try_push(&fifo, (void *)5)) test_failed();
+
+	// The new buffer is empty, even though nothing was popped from the old one
+	if (!fifo_resize(&fifo, 8) || fifo_length(&fifo) != 8) test_failed();
+	for (uintptr_t i=5; i<=12; i++)
+		if (!fifo_try_push(&fifo, (void *)i)) test_failed();
+	if (fifo_try_push(&fifo, (void *)13)) test_failed();
+
+	// Consumer 0 reads everything and moves to a smaller buffer, consumer 1 stays
+	// in the old ones
+	for (uintptr_t i=1; i<=12; i++)
+		if (!fifo_try_pop(&fifo, 0, &tmp) || tmp != (void *)i) test_failed();
+	if (!fifo_resize(&fifo, 2)) test_failed();
+	if (!fifo_try_push(&fifo, (void *)13) || !fifo_try_push(&fifo, (void *)14))
+		test_failed();
+	if (fifo_try_push(&fifo, (void *)15)) test_failed();
+	if (!fifo_try_pop(&fifo, 0, &tmp) || tmp != (void *)13) test_failed();
+	if (fifo_try_push(&fifo, (void *)15)) test_failed();
+	for (uintptr_t i=1; i<=13; i++)
+		if (!fifo_try_pop(&fifo, 1, &tmp) || tmp != (void *)i) test_failed();
+	if (!fifo_try_push(&fifo, (void *)15)) test_failed();
+	for (uintptr_t i=14; i<=15; i++) {
+		for (int k=0; k<2; k++)
+			if (!fifo_try_pop(&fifo, k, &tmp) || tmp != (void *)i) test_failed();
+	}
+	if (fifo_try_pop(&fifo, 0, &tmp) || fifo_try_pop(&fifo, 1, &tmp)) test_failed();
+	fifo_destroy(&fifo);
+
+	// Grows by itself when full, up to max_length: 2, 4 and 5 positions, while
+	// the old buffers keep what wasn't popped
+	fifo_config_t config = { .length = 2, .consumers = 1, .max_length = 5 };
+	fifo_init_config(&fifo, &config);
+	for (uintptr_t i=1; i<=11; i++)
+		if (!fifo_try_push(&fifo, (void *)i)) test_failed();
+	if (fifo_length(&fifo) != 5 || fifo_try_push(&fifo, (void *)12)) test_failed();
+	for (uintptr_t i=1; i<=11; i++)
+		if (!fifo_try_pop(&fifo, 0, &tmp) || tmp != (void *)i) test_failed();
+	fifo_destroy(&fifo);
+
+	// Not with groups or in overwrite mode
+	fifo_init(&fifo, 4, 2);
+	fifo_set_group(&fifo, 1);
+	if (fifo_resize(&fifo, 8)) test_failed();
+	fifo_destroy(&fifo);
+	config = (fifo_config_t){ .length = 4, .consumers = 1, .overwrite = true };
+	fifo_init_config(&fifo, &config);
+	if (fifo_resize(&fifo, 8)) test_failed();
+	fifo_destroy(&fifo);
+
+	printf("Done.\n");
+}
+
+// Runs push_fn and pop_fn threads while another thread resizes the FIFO
+static void run_resized(void * (*push_fn)(void *), void * (*pop_fn)(void *)) {
+	pthread_t resizer;
+	atomic_store(&push_done, false);
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop_fn, &id[i]);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push_fn, &id[i]);
+	pthread_create(&resizer, &attr, resize, NULL);
+
+	for (int i=0; i<test_threads_push; i++)
+		pthread_join(threads[i + test_threads_pop], NULL);
+	atomic_store(&push_done, true);
+	pthread_join(resizer, NULL);
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_join(threads[i], NULL);
+}
+
+void test_resize(void) {
+	test_threads_pop = THREADS_POP;
+	test_threads_push = THREADS_PUSH;
+	test_threads_count = THREADS_POP + THREADS_PUSH;
+
+	printf("Test resize %u pop, %u push\n", test_threads_pop, test_threads_push);
+	fifo_init(&fifo, FIFO_LEN, test_threads_pop);
+	run_resized(push, pop);
+	fifo_destroy(&fifo);
+
+	fifo_init(&fifo, FIFO_LEN, test_threads_pop);
+	run_resized(push_batch, pop_batch);
+	fifo_destroy(&fifo);
+
+	fifo_init_records(&fifo, FIFO_LEN, test_threads_pop, sizeof(record_t));
+	run_resized(push_record, pop_record);
+	fifo_destroy(&fifo);
+
+	pool_t pool;
+	pool_init(&pool);
+	fifo_init(&fifo, FIFO_LEN, test_threads_pop);
+	fifo_set_pool(&fifo, &pool);
+	run_resized(push_payload, pop_payload);
+	fifo_destroy(&fifo);
+	pool_destroy(&pool);
+
+	// Producers grow it, 1 position at first
+	fifo_config_t config = { .length = 1, .consumers = test_threads_pop,
+	                         .max_length = 4 * FIFO_LEN };
+	fifo_init_config(&fifo, &config);
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop, &id[i]);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push, &id[i]);
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+	if (fifo_length(&fifo) == 1) test_failed();
+	fifo_destroy(&fifo);
+
+	printf("Done.\n");
+}
+
+void test_flow_control_single_threaded(void) {
+	fifo_init(&fifo, 8, 2);
+	fifo_set_watermarks(&fifo, 6, 2, on_watermark, NULL);
+	atomic_store(&watermark_changes, 0);
+	atomic_store(&watermark_high, false);
+
+	printf("Test watermarks / credits single threaded\n");
+	void * tmp;
+	for (uintptr_t i=1; i<=5; i++)
+		fifo_push(&fifo, (void *)i);
+	if (fifo_congested(&fifo) || atomic_load(&watermark_changes)) test_failed();
+	fifo_push(&fifo, (void *)6);
+	if (!fifo_congested(&fifo) || atomic_load(&watermark_changes) != 1) test_failed();
+
+	// Pointers count until every consumer popped them
+	for (uintptr_t i=1; i<=6; i++)
+		if (!fifo_try_pop(&fifo, 0, &tmp) || tmp != (void *)i) test_failed();
+	for (uintptr_t i=1; i<=3; i++)
+		if (!fifo_try_pop(&fifo, 1, &tmp) || tmp != (void *)i) test_failed();
+	if (!fifo_congested(&fifo)) test_failed();
+	if (!fifo_try_pop(&fifo, 1, &tmp) || tmp != (void *)4) test_failed();
+	if (fifo_congested(&fifo) || atomic_load(&watermark_changes) != 2) test_failed();
+	for (uintptr_t i=5; i<=6; i++)
+		if (!fifo_try_pop(&fifo, 1, &tmp) || tmp != (void *)i) test_failed();
+
+	// Reserved positions count too, and nobody else can take them
+	fifo_credit_t credit, other;
+	if (fifo_reserve(&fifo, 9, &credit)) test_failed();
+	if (!fifo_reserve(&fifo, 6, &credit) || !fifo_congested(&fifo)) test_failed();
+	if (fifo_try_reserve(&fifo, 3, &other)) test_failed();
+	if (!fifo_try_reserve(&fifo, 2, &other)) test_failed();
+	if (fifo_try_push(&fifo, (void *)15)) test_failed();
+
+	// Consumers wait for the first reserved position
+	if (!fifo_push_credit(&fifo, &other, (void *)13)) test_failed();
+	if (fifo_try_pop(&fifo, 0, &tmp)) test_failed();
+	for (uintptr_t i=7; i<=12; i++)
+		if (!fifo_push_credit(&fifo, &credit, (void *)i)) test_failed();
+	if (fifo_push_credit(&fifo, &credit, (void *)0)) test_failed();
+	if (!fifo_push_credit(&fifo, &other, (void *)14)) test_failed();
+	for (uintptr_t i=7; i<=14; i++) {
+		for (int k=0; k<2; k++)
+			if (!fifo_try_pop(&fifo, k, &tmp) || tmp != (void *)i) test_failed();
+	}
+	if (fifo_congested(&fifo) || atomic_load(&watermark_changes) != 4) test_failed();
+
+	fifo_destroy(&fifo);
+	printf("Done.\n");
+}
+
+void test_flow_control(void) {
+	test_threads_pop = THREADS_POP;
+	test_threads_push = THREADS_PUSH;
+	test_threads_count = THREADS_POP + THREADS_PUSH;
+
+	fifo_init(&fifo, FIFO_LEN, test_threads_pop);
+	fifo_set_watermarks(&fifo, FIFO_LEN - 2, 3, on_watermark, NULL);
+	atomic_store(&watermark_changes, 0);
+	atomic_store(&watermark_high, false);
+
+	printf("Test watermarks / credits %u pop, %u push\n", test_threads_pop,
+	       test_threads_push);
+	for (int i=0; i<test_threads_push; i++)
+		pthread_create(&threads[i + test_threads_pop], &attr, push_reserved, &id[i]);
+
+	for (int i=0; i<test_threads_pop; i++)
+		pthread_create(&threads[i], &attr, pop, &id[i]);
+
+	for (int i=0; i<test_threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	// Empty again, so the last change was back to low
+	uint32_t changes = atomic_load(&watermark_changes);
+	if (fifo_congested(&fifo) || changes % 2) {
+		ERROR("%u watermark changes, congested %d\n", changes, fifo_congested(&fifo));
+		test_failed();
+	}
+
+	fifo_destroy(&fifo);
+	printf("Done (%u watermark changes).\n", changes);
+}
+
+// Checks the buffers in use are on the producers' node and each cursor on its
+// consumer's node. Call after the FIFO was used, so the pages were touched.
+static void check_placement(const int * nodes) {
+	fifo_ring_t * ring = atomic_load(&fifo.ring);
+	int producer = node_count() - 1;
+	if (fifo.node != producer || node_of(ring->buffer) != producer) {
+		ERROR("Buffer on node %d (%d), expected %d\n", node_of(ring->buffer), fifo.node,
+		      producer);
+		test_failed();
+	}
+	if (ring->records && node_of(ring->records) != producer) {
+		ERROR("Records on node %d, expected %d\n", node_of(ring->records), producer);
+		test_failed();
+	}
+	for (int i=0; i<test_threads_pop; i++) {
+		const uint8_t * c = (const uint8_t *)fifo.cursors + i * fifo.cursor_stride;
+		if (node_of(c) != nodes[i]) {
+			ERROR("Cursor %d on node %d, expected %d\n", i, node_of(c), nodes[i]);
+			test_failed();
+		}
+	}
+}
+
+void test_numa(void) {
+	test_threads_pop = THREADS_POP;
+	test_threads_push = THREADS_PUSH;
+	test_threads_count = THREADS_POP + THREADS_PUSH;
+
+	printf("Test NUMA placement %u pop, %u push\n", test_threads_pop, test_threads_push);
+	// Consumers spread over every node
+	int nodes[THREADS_POP];
+	for (int i=0; i<test_threads_pop; i++)
+		nodes[i] = i % node_count();
+	fifo_config_t config = { .length = FIFO_LEN, .consumers = test_threads_pop,
+	                         .numa = true, .producer_node = node_count() - 1,
+	                         .consumer_nodes = nodes };
+	fifo_init_config(&fifo, &config);
+	run_resized(push, pop);
+	check_placement(nodes);
+	fifo_destroy(&fifo);
+
+	config.record_size = sizeof(record_t);
+	fifo_init_config(&fifo, &config);
+	run_resized(push_record, pop_record);
+	check_placement(nodes);
+	fifo_destroy(&fifo);
+
+	printf("Done.\n");
+}
+
+int main() {
+	srand(time(NULL));
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+	for (int i=0; i<THREAD_COUNT; i++)
+		id[i] = i;
+
+	test_single_threaded();
+	test_try_timed();
+	test_single_push(false);
+	test_single_push(true);
+	test_single_pop();
+	test_multiple();
+	test_batch();
+	test_records();
+	test_pool();
+	test_wait_strategies();
+	test_attach_single_threaded();
+	test_attach();
+	test_attach_race();
+	test_overwrite_single_threaded();
+	test_overwrite();
+	test_group_single_threaded();
+	test_group();
+	test_select();
+	test_fd_single_threaded();
+	test_fd();
+	test_sharded(THREADS_PUSH);
+	test_sharded(4);
+	test_priority_single_threaded();
+	test_priority();
+	test_stats_single_threaded();
+	test_stats();
+	test_resize_single_threaded();
+	test_resize();
+	test_flow_control_single_threaded();
+	test_flow_control();
+	test_numa();
 
 	pthread_attr_destroy(&attr);
 	pthread_exit(NULL);
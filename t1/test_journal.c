@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include "journal.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SEGMENT_RECORDS 16
+#define ITERATIONS     500
+#define THREADS_PUSH   4
+#define THREADS_READ   4
+
+#define ERROR(...) do { printf(__VA_ARGS__); printf("Line: %d\n", __LINE__); } while (0);
+
+typedef struct {
+	uint32_t producer;
+	uint32_t value;
+	char text[20];
+} message_t;
+
+pthread_t threads[THREADS_PUSH + THREADS_READ];
+pthread_attr_t attr;
+uint32_t id[THREADS_PUSH + THREADS_READ];
+char dir[64];
+journal_t journal;
+
+static void test_failed(void) {
+	exit(1);
+}
+
+static void remove_dir(void) {
+	char cmd[128];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd))
+		printf("Could not remove %s\n", dir);
+}
+
+static uint32_t count_segments(void) {
+	char cmd[128];
+	snprintf(cmd, sizeof(cmd), "ls %s | wc -l", dir);
+	FILE * f = popen(cmd, "r");
+	uint32_t count = 0;
+	if (fscanf(f, "%u", &count) != 1)
+		count = 0;
+	pclose(f);
+	return count;
+}
+
+static void push_value(uint32_t producer, uint32_t value) {
+	uint64_t seq;
+	message_t * m = (message_t *)journal_claim(&journal, &seq);
+	if (!m) {
+		ERROR("Claim failed: %s\n", strerror(errno));
+		test_failed();
+	}
+	m->producer = producer;
+	m->value = value;
+	snprintf(m->text, sizeof(m->text), "%u:%u", producer, value);
+	journal_publish(&journal, seq);
+}
+
+// Reads count values of producer 0, from first on
+static void check_values(uint64_t first, uint32_t count) {
+	journal_reader_t reader;
+	if (journal_reader_init(&reader, &journal, first) < 0) test_failed();
+	for (uint32_t i=0; i<count; i++) {
+		const message_t * m = (const message_t *)journal_read(&reader);
+		if (m->value != first + i) {
+			ERROR("Expected %llu, got %u\n", (unsigned long long)(first + i), m->value);
+			test_failed();
+		}
+		journal_release(&reader);
+	}
+	if (journal_try_read(&reader)) test_failed();
+	journal_reader_destroy(&reader);
+}
+
+void * push(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start push %u\n", id);
+	for (uint32_t i=0; i<ITERATIONS; i++)
+		push_value(id, i);
+	printf("Push done %u\n", id);
+	return NULL;
+}
+
+// Starts at the oldest record retained, values of each producer only increase
+// and the ones after the start are consecutive
+void * read_values(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	printf("Start read %u\n", id);
+	usleep(id * 1000);
+
+	journal_reader_t reader;
+	uint64_t start;
+	do {
+		start = journal_first(&journal);
+	} while (journal_reader_init(&reader, &journal, start) < 0);
+
+	int64_t last[THREADS_PUSH];
+	for (int i=0; i<THREADS_PUSH; i++)
+		last[i] = -1;
+	for (uint64_t seq=start; seq<ITERATIONS * THREADS_PUSH; seq++) {
+		const message_t * m = (const message_t *)journal_read(&reader);
+		char text[20];
+		snprintf(text, sizeof(text), "%u:%u", m->producer, m->value);
+		if (m->producer >= THREADS_PUSH || strcmp(text, m->text)
+		    || (int64_t)m->value <= last[m->producer]
+		    || (last[m->producer] >= 0 && m->value != last[m->producer] + 1)) {
+			ERROR("Read (%u): got %s\n", id, m->text);
+			test_failed();
+		}
+		last[m->producer] = m->value;
+		journal_release(&reader);
+	}
+	journal_reader_destroy(&reader);
+
+	printf("Read done %u (from %llu)\n", id, (unsigned long long)start);
+	return NULL;
+}
+
+void test_replay(void) {
+	printf("Test replay\n");
+	journal_config_t config = { .dir = dir, .record_size = sizeof(message_t),
+	                            .segment_records = SEGMENT_RECORDS };
+	if (journal_open(&journal, &config) < 0) test_failed();
+	if (journal_first(&journal) != 0 || journal_next(&journal) != 0) test_failed();
+
+	for (uint32_t i=0; i<40; i++)
+		push_value(0, i);
+	check_values(0, 40);
+	check_values(17, 23);
+	check_values(40, 0);
+	journal_reader_t reader;
+	if (journal_reader_init(&reader, &journal, 41) == 0 || errno != ERANGE) test_failed();
+	journal_close(&journal);
+
+	// Restarted: the log is still there
+	if (journal_open(&journal, &config) < 0) test_failed();
+	if (journal_next(&journal) != 40) test_failed();
+	check_values(5, 35);
+	push_value(0, 40);
+	check_values(30, 11);
+	journal_close(&journal);
+
+	// A different record size is rejected
+	config.record_size = 2 * sizeof(message_t);
+	if (journal_open(&journal, &config) == 0 || errno != EINVAL) test_failed();
+	printf("Done.\n");
+}
+
+void test_recover_hole(void) {
+	printf("Test recovery of an unpublished record in an older segment\n");
+	remove_dir();
+	journal_config_t config = { .dir = dir, .record_size = sizeof(message_t),
+	                            .segment_records = SEGMENT_RECORDS };
+	if (journal_open(&journal, &config) < 0) test_failed();
+
+	// A producer claims 5 and crashes before publishing it, the others go on to
+	// fill 3 segments
+	for (uint32_t i=0; i<5; i++)
+		push_value(0, i);
+	uint64_t hole;
+	if (!journal_claim(&journal, &hole) || hole != 5) test_failed();
+	for (uint32_t i=6; i<3 * SEGMENT_RECORDS; i++)
+		push_value(0, i);
+	if (count_segments() != 3) test_failed();
+	journal_close(&journal);
+
+	// The log ends at the hole, and only its segment is left
+	if (journal_open(&journal, &config) < 0) test_failed();
+	if (journal_next(&journal) != 5 || count_segments() != 1) {
+		ERROR("Next %llu, %u segments\n", (unsigned long long)journal_next(&journal),
+		      count_segments());
+		test_failed();
+	}
+	check_values(0, 5);
+	// Readers don't get stuck: the sequences after the hole are claimed again
+	for (uint32_t i=5; i<2 * SEGMENT_RECORDS; i++)
+		push_value(0, i);
+	check_values(0, 2 * SEGMENT_RECORDS);
+	journal_close(&journal);
+	printf("Done.\n");
+}
+
+void test_claim_failure(void) {
+	printf("Test claim when a segment can't be added\n");
+	remove_dir();
+	journal_config_t config = { .dir = dir, .record_size = sizeof(message_t),
+	                            .segment_records = SEGMENT_RECORDS };
+	if (journal_open(&journal, &config) < 0) test_failed();
+	for (uint32_t i=0; i<SEGMENT_RECORDS; i++)
+		push_value(0, i);
+
+	// A directory with the name of the next segment file makes creating it fail
+	char path[128];
+	snprintf(path, sizeof(path), "%s/%020u.seg", dir, SEGMENT_RECORDS);
+	if (mkdir(path, 0755) < 0) test_failed();
+	journal_reader_t reader;
+	if (journal_reader_init(&reader, &journal, SEGMENT_RECORDS) < 0) test_failed();
+	uint64_t seq;
+	if (journal_claim(&journal, &seq) || journal_next(&journal) != SEGMENT_RECORDS) {
+		ERROR("Claim didn't fail, or took a sequence: next %llu\n",
+		      (unsigned long long)journal_next(&journal));
+		test_failed();
+	}
+
+	// The failed claim left no hole: the reader gets the next record
+	rmdir(path);
+	push_value(0, SEGMENT_RECORDS);
+	const message_t * m = (const message_t *)journal_try_read(&reader);
+	if (!m || m->value != SEGMENT_RECORDS) {
+		ERROR("Reader stuck at %llu\n", (unsigned long long)reader.seq);
+		test_failed();
+	}
+	journal_release(&reader);
+	journal_reader_destroy(&reader);
+	check_values(0, SEGMENT_RECORDS + 1);
+	journal_close(&journal);
+	printf("Done.\n");
+}
+
+void test_retention(void) {
+	printf("Test retention\n");
+	remove_dir();
+	// Segments of 16 records, keep 2 of them
+	journal_config_t config = { .dir = dir, .record_size = sizeof(message_t),
+	                            .segment_records = SEGMENT_RECORDS };
+	if (journal_open(&journal, &config) < 0) test_failed();
+	config.retention_bytes = 2 * journal.size;
+	journal_close(&journal);
+	if (journal_open(&journal, &config) < 0) test_failed();
+
+	// A reader holds its segment and the ones after it
+	journal_reader_t reader;
+	if (journal_reader_init(&reader, &journal, 0) < 0) test_failed();
+	for (uint32_t i=0; i<100; i++)
+		push_value(0, i);
+	if (journal_first(&journal) != 0 || count_segments() != 7) test_failed();
+	journal_reader_destroy(&reader);
+
+	// Applied when a segment is added
+	for (uint32_t i=100; i<112; i++)
+		push_value(0, i);
+	if (journal_first(&journal) != 0) test_failed();
+	push_value(0, 112);
+	if (journal_first(&journal) != 96 || count_segments() != 2) test_failed();
+	check_values(96, 17);
+	if (journal_reader_init(&reader, &journal, 95) == 0) test_failed();
+	journal_close(&journal);
+
+	// Segments whose records are all older than 1 s
+	config.retention_bytes = 0;
+	config.retention_secs = 1;
+	if (journal_open(&journal, &config) < 0) test_failed();
+	sleep(2);
+	for (uint32_t i=113; i<129; i++)
+		push_value(0, i);
+	if (journal_first(&journal) != 112) test_failed();
+	journal_close(&journal);
+	printf("Done.\n");
+}
+
+void test_multiple(void) {
+	printf("Test %u push, %u read\n", THREADS_PUSH, THREADS_READ);
+	remove_dir();
+	journal_config_t config = { .dir = dir, .record_size = sizeof(message_t),
+	                            .segment_records = SEGMENT_RECORDS,
+	                            .retention_bytes = 64 * 1024 };
+	if (journal_open(&journal, &config) < 0) test_failed();
+
+	for (int i=0; i<THREADS_READ; i++)
+		pthread_create(&threads[i], &attr, read_values, &id[i]);
+	for (int i=0; i<THREADS_PUSH; i++)
+		pthread_create(&threads[THREADS_READ + i], &attr, push, &id[i]);
+
+	for (int i=0; i<THREADS_PUSH + THREADS_READ; i++)
+		pthread_join(threads[i], NULL);
+
+	journal_close(&journal);
+	printf("Done.\n");
+}
+
+int main() {
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+	for (int i=0; i<THREADS_PUSH + THREADS_READ; i++)
+		id[i] = i;
+	snprintf(dir, sizeof(dir), "/tmp/test_journal_%d", (int)getpid());
+
+	test_replay();
+	test_recover_hole();
+	test_claim_failure();
+	test_retention();
+	test_multiple();
+
+	remove_dir();
+	pthread_attr_destroy(&attr);
+	return 0;
+}
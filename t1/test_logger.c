@@ -0,0 +1,227 @@
+#define _POSIX_C_SOURCE 200809L
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define ITERATIONS     500
+#define THREADS        8
+#define DROP_LINES     1000
+
+#define ERROR(...) do { printf(__VA_ARGS__); printf("Line: %d\n", __LINE__); } while (0);
+
+pthread_t threads[THREADS];
+uint32_t id[THREADS];
+logger_t logger;
+char path[64];
+
+static void test_failed(void) {
+	unlink(path);
+	exit(1);
+}
+
+void delay(void) {
+	struct timespec t;
+	t.tv_sec = 0;
+	t.tv_nsec = (rand() % 100) * 1000;
+	nanosleep(&t, NULL);
+}
+
+// Empty log file to write to
+static int open_log(void) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		test_failed();
+	return fd;
+}
+
+// Whole log file, to be freed
+static char * read_log(void) {
+	FILE * f = fopen(path, "r");
+	if (!f)
+		test_failed();
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	rewind(f);
+	char * data = (char *)malloc(size + 1);
+	if (fread(data, 1, size, f) != (size_t)size)
+		test_failed();
+	data[size] = '\0';
+	fclose(f);
+	return data;
+}
+
+// Logs ITERATIONS lines in order
+void * log_lines(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	for (uint32_t i=0; i<ITERATIONS; i++) {
+		if (i % 50 == 0)
+			delay();
+		if (!logger_printf(&logger, "T%u %u\n", id, i)) {
+			ERROR("Thread %u: line %u dropped\n", id, i);
+			test_failed();
+		}
+	}
+	return NULL;
+}
+
+void test_format(void) {
+	printf("Test format\n");
+	int fd = open_log();
+	if (logger_init(&logger, fd, 0) < 0) test_failed();
+
+	char expected[1024];
+	char text[20];
+	int len = 0;
+	long long big = -1234567890123LL;
+	void * p = &logger;
+	strcpy(text, "copied");
+	logger_printf(&logger, "%d %5u|%-4x|%08.3f %c %s %% %p\n", -42, 7u, 255u, 3.14159,
+	              'z', text, p);
+	len += snprintf(expected + len, sizeof(expected) - len,
+	                "%d %5u|%-4x|%08.3f %c %s %% %p\n", -42, 7u, 255u, 3.14159, 'z',
+	                text, p);
+	// The string is copied when logged
+	strcpy(text, "changed");
+	logger_printf(&logger, "%lld %hhd %zu %.3s %e\n", big, 300, (size_t)12, "abcdef", 1e-5);
+	len += snprintf(expected + len, sizeof(expected) - len, "%lld %hhd %zu %.3s %e\n",
+	                big, (signed char)300, (size_t)12, "abcdef", 1e-5);
+	logger_printf(&logger, "no arguments\n");
+	len += snprintf(expected + len, sizeof(expected) - len, "no arguments\n");
+	logger_flush(&logger);
+
+	char * data = read_log();
+	if (strcmp(data, expected)) {
+		ERROR("Expected:\n%sGot:\n%s", expected, data);
+		test_failed();
+	}
+	free(data);
+
+	logger_destroy(&logger);
+	close(fd);
+	printf("Done.\n");
+}
+
+void test_drop(void) {
+	printf("Test drop\n");
+	int fd = open_log();
+	if (logger_init(&logger, fd, 4) < 0) test_failed();
+
+	uint32_t logged = 0;
+	for (uint32_t i=0; i<DROP_LINES; i++)
+		logged += logger_printf(&logger, "%u\n", i);
+	uint64_t dropped = logger_dropped(&logger);
+	logger_destroy(&logger);
+	close(fd);
+
+	if (logged + dropped != DROP_LINES) test_failed();
+
+	// Lines in order, and a note where lines are missing
+	char * data = read_log();
+	uint64_t lines = 0;
+	uint64_t notes = 0;
+	int64_t last = -1;
+	for (char * line = strtok(data, "\n"); line; line = strtok(NULL, "\n")) {
+		unsigned long long n;
+		if (sscanf(line, "[%llu lines dropped]", &n) == 1) {
+			notes += n;
+			last += n;
+		} else if (strtoll(line, NULL, 10) != ++last) {
+			ERROR("Expected %" PRId64 ", got %s\n", last, line);
+			test_failed();
+		} else {
+			lines++;
+		}
+	}
+	free(data);
+	if (lines != logged || notes != dropped) {
+		ERROR("%" PRIu64 " lines, %" PRIu64 " dropped notes, %u logged, %" PRIu64
+		      " dropped\n", lines, notes, logged, dropped);
+		test_failed();
+	}
+
+	printf("Done (%u written, %" PRIu64 " dropped).\n", logged, dropped);
+}
+
+void test_threads(void) {
+	printf("Test %u threads\n", THREADS);
+	int fd = open_log();
+	if (logger_init(&logger, fd, 0) < 0) test_failed();
+
+	for (int i=0; i<THREADS; i++)
+		pthread_create(&threads[i], NULL, log_lines, &id[i]);
+	for (int i=0; i<THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	logger_destroy(&logger);
+	close(fd);
+
+	// Every line of each thread, in the order it logged them
+	uint32_t counters[THREADS] = {0};
+	char * data = read_log();
+	for (char * line = strtok(data, "\n"); line; line = strtok(NULL, "\n")) {
+		unsigned t, i;
+		if (sscanf(line, "T%u %u", &t, &i) != 2 || t >= THREADS || i != counters[t]++) {
+			ERROR("Unexpected line: %s\n", line);
+			test_failed();
+		}
+	}
+	free(data);
+	for (int i=0; i<THREADS; i++)
+		if (counters[i] != ITERATIONS) test_failed();
+
+	printf("Done.\n");
+}
+
+void test_exit(void) {
+	printf("Test flush on exit\n");
+	// The child must not print the parent's buffered output again
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0)
+		test_failed();
+	if (pid == 0) {
+		int fd = open_log();
+		if (logger_init(&logger, fd, 0) < 0)
+			exit(1);
+		for (uint32_t i=0; i<ITERATIONS; i++)
+			logger_printf(&logger, "%u\n", i);
+		exit(0);
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		test_failed();
+
+	char * data = read_log();
+	uint32_t count = 0;
+	for (char * line = strtok(data, "\n"); line; line = strtok(NULL, "\n")) {
+		if (strtoul(line, NULL, 10) != count++)
+			test_failed();
+	}
+	free(data);
+	if (count != ITERATIONS) test_failed();
+
+	printf("Done.\n");
+}
+
+int main() {
+	srand(time(NULL));
+	snprintf(path, sizeof(path), "/tmp/test_logger_%d.log", (int)getpid());
+	for (int i=0; i<THREADS; i++)
+		id[i] = i;
+
+	test_format();
+	test_drop();
+	test_threads();
+	test_exit();
+
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,84 @@
+#define _POSIX_C_SOURCE 200809L
+#include "node.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define ERROR(...) do { printf(__VA_ARGS__); printf("Line: %d\n", __LINE__); } while (0);
+
+static void test_failed(void) {
+	exit(1);
+}
+
+void test_bind(void) {
+	printf("Test thread binding\n");
+	int nodes = node_count();
+	if (nodes < 1) {
+		ERROR("%d nodes\n", nodes);
+		test_failed();
+	}
+
+	for (int n=0; n<nodes; n++) {
+		// Memory only nodes have no CPUs to run on
+		if (node_bind_thread(n) < 0)
+			continue;
+		if (node_current() != n) {
+			ERROR("Bound to node %d, running on %d\n", n, node_current());
+			test_failed();
+		}
+	}
+	if (node_bind_thread(nodes) == 0 || node_bind_thread(-1) == 0) {
+		ERROR("Bound to a node that doesn't exist\n");
+		test_failed();
+	}
+	printf("Done (%d nodes).\n", nodes);
+}
+
+void test_alloc(void) {
+	printf("Test allocation\n");
+	size_t page = node_page_size();
+	for (int n=-1; n<node_count(); n++) {
+		size_t size = 3 * page + 1;
+		uint8_t * p = (uint8_t *)node_alloc(size, n);
+		if (!p || (uintptr_t)p % page) {
+			ERROR("Node %d: %p\n", n, (void *)p);
+			test_failed();
+		}
+		for (size_t i=0; i<size; i++) {
+			if (p[i]) {
+				ERROR("Node %d: byte %zu not zeroed\n", n, i);
+				test_failed();
+			}
+			p[i] = (uint8_t)i;
+		}
+		// Pages went where asked, the first toucher's node otherwise
+		int expected = n >= 0 ? n : node_current();
+		if (node_of(p) != expected || node_of(p + size - 1) != expected) {
+			ERROR("Node %d: placed on %d\n", n, node_of(p));
+			test_failed();
+		}
+		// Moving the placement keeps the contents
+		if (node_place(p + page, 2 * page, 0) < 0) {
+			ERROR("Node %d: %s\n", n, strerror(errno));
+			test_failed();
+		}
+		for (size_t i=0; i<size; i++) {
+			if (p[i] != (uint8_t)i) {
+				ERROR("Node %d: byte %zu changed\n", n, i);
+				test_failed();
+			}
+		}
+		node_free(p, size);
+	}
+	node_free(NULL, page);
+	printf("Done.\n");
+}
+
+int main() {
+	test_bind();
+	test_alloc();
+	return 0;
+}
@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200809L
+#include "pipeline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define ITEMS          2000
+#define LENGTH         8
+
+#define ERROR(...) do { printf(__VA_ARGS__); printf("Line: %d\n", __LINE__); } while (0);
+
+pipeline_t pipeline;
+// Source state
+uint32_t produced;
+// Sink results
+uint64_t sum;
+atomic_ullong parallel_sum;
+atomic_uint counted;
+
+static void test_failed(void) {
+	exit(1);
+}
+
+void delay(void) {
+	struct timespec t;
+	t.tv_sec = 0;
+	t.tv_nsec = (rand() % 100) * 1000;
+	nanosleep(&t, NULL);
+}
+
+// Items are the numbers from 1 to ITEMS
+void * source(void * arg, void * item) {
+	if (produced == ITEMS)
+		return NULL;
+	return (void *)(uintptr_t)++produced;
+}
+
+// Counts forever, until the pipeline stops
+void * endless_source(void * arg, void * item) {
+	return (void *)(uintptr_t)++produced;
+}
+
+void * twice(void * arg, void * item) {
+	return (void *)((uintptr_t)item * 2);
+}
+
+// Drops multiples of 3
+void * filter(void * arg, void * item) {
+	return (uintptr_t)item % 3 ? item : NULL;
+}
+
+void * sum_sink(void * arg, void * item) {
+	if (rand() % 100 == 0)
+		delay();
+	sum += (uintptr_t)item;
+	return item;
+}
+
+void * parallel_sink(void * arg, void * item) {
+	delay();
+	atomic_fetch_add(&parallel_sum, (uintptr_t)item);
+	atomic_fetch_add(&counted, 1);
+	return item;
+}
+
+static void check_stats(uint32_t stage, uint64_t in, uint64_t out, bool fused) {
+	pipeline_stats_t stats;
+	pipeline_stats(&pipeline, stage, &stats);
+	if (stats.in != in || stats.out != out || stats.fused != fused || !stats.elapsed_ns) {
+		ERROR("Stage %u: in %" PRIu64 ", out %" PRIu64 ", fused %d\n", stage, stats.in,
+		      stats.out, stats.fused);
+		test_failed();
+	}
+}
+
+void test_fan_out(void) {
+	printf("Test source -> transform -> filter -> 2 sinks\n");
+	produced = 0;
+	sum = 0;
+	atomic_store(&parallel_sum, 0);
+	atomic_store(&counted, 0);
+
+	pipeline_init(&pipeline, LENGTH);
+	int src = pipeline_add(&pipeline, "source", source, NULL, 1, 0);
+	int dbl = pipeline_add(&pipeline, "twice", twice, NULL, 2, PIPELINE_STATELESS);
+	int flt = pipeline_add(&pipeline, "filter", filter, NULL, 2, PIPELINE_STATELESS);
+	int sink1 = pipeline_add(&pipeline, "sum", sum_sink, NULL, 1, 0);
+	int sink2 = pipeline_add(&pipeline, "parallel", parallel_sink, NULL, 3,
+	                         PIPELINE_STATELESS);
+	if (!pipeline_connect(&pipeline, src, dbl)) test_failed();
+	if (!pipeline_connect(&pipeline, dbl, flt)) test_failed();
+	if (!pipeline_connect(&pipeline, flt, sink1)) test_failed();
+	if (!pipeline_connect(&pipeline, flt, sink2)) test_failed();
+	// A stage has only one input
+	if (pipeline_connect(&pipeline, src, sink2)) test_failed();
+
+	if (pipeline_start(&pipeline) < 0) test_failed();
+	pipeline_wait(&pipeline);
+
+	uint64_t expected = 0;
+	uint32_t passed = 0;
+	for (uint64_t i=1; i<=ITEMS; i++) {
+		if ((i * 2) % 3) {
+			expected += i * 2;
+			passed++;
+		}
+	}
+	if (sum != expected || atomic_load(&parallel_sum) != expected
+	    || atomic_load(&counted) != passed) {
+		ERROR("Sums %" PRIu64 " and %llu, expected %" PRIu64 "\n", sum,
+		      (unsigned long long)atomic_load(&parallel_sum), expected);
+		test_failed();
+	}
+
+	// The filter runs in the threads of the transform
+	check_stats(src, 0, ITEMS, false);
+	check_stats(dbl, ITEMS, ITEMS, false);
+	check_stats(flt, ITEMS, passed, true);
+	check_stats(sink1, passed, passed, false);
+	check_stats(sink2, passed, passed, false);
+
+	pipeline_destroy(&pipeline);
+	printf("Done.\n");
+}
+
+void test_stop(void) {
+	printf("Test stop\n");
+	produced = 0;
+	atomic_store(&counted, 0);
+	atomic_store(&parallel_sum, 0);
+
+	pipeline_init(&pipeline, LENGTH);
+	int src = pipeline_add(&pipeline, "source", endless_source, NULL, 1, 0);
+	int sink = pipeline_add(&pipeline, "parallel", parallel_sink, NULL, 4, 0);
+	pipeline_connect(&pipeline, src, sink);
+	if (pipeline_start(&pipeline) < 0) test_failed();
+
+	struct timespec t = { 0, 20000000 };
+	nanosleep(&t, NULL);
+	pipeline_stop(&pipeline);
+	pipeline_wait(&pipeline);
+
+	// Everything produced before the stop was consumed
+	if (!produced || atomic_load(&counted) != produced) {
+		ERROR("Produced %u, consumed %u\n", produced, atomic_load(&counted));
+		test_failed();
+	}
+	check_stats(sink, produced, produced, false);
+
+	pipeline_destroy(&pipeline);
+	printf("Done (%u items).\n", produced);
+}
+
+// Virtual memory of the process, in bytes
+static size_t vm_size(void) {
+	FILE * f = fopen("/proc/self/statm", "r");
+	size_t pages = 0;
+	if (!f || fscanf(f, "%zu", &pages) != 1)
+		pages = 0;
+	if (f)
+		fclose(f);
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+void test_start_failure(void) {
+	printf("Test failed start\n");
+	produced = 0;
+	atomic_store(&counted, 0);
+	atomic_store(&parallel_sum, 0);
+
+	pipeline_init(&pipeline, LENGTH);
+	int src = pipeline_add(&pipeline, "source", endless_source, NULL, 1, 0);
+	int dbl = pipeline_add(&pipeline, "twice", twice, NULL, 2, 0);
+	int sink = pipeline_add(&pipeline, "parallel", parallel_sink, NULL, 64, 0);
+	pipeline_connect(&pipeline, src, dbl);
+	pipeline_connect(&pipeline, dbl, sink);
+
+	// Room for the stacks of a few threads only, so starting the sink fails
+	struct rlimit old, limit;
+	getrlimit(RLIMIT_AS, &old);
+	limit = old;
+	limit.rlim_cur = vm_size() + 64 * 1024 * 1024;
+	setrlimit(RLIMIT_AS, &limit);
+	int ret = pipeline_start(&pipeline);
+	int error = errno;
+	setrlimit(RLIMIT_AS, &old);
+	if (ret == 0) {
+		// Not enforced here: nothing to test
+		pipeline_stop(&pipeline);
+		pipeline_wait(&pipeline);
+		pipeline_destroy(&pipeline);
+		printf("Done (every thread started).\n");
+		return;
+	}
+	if (error != EAGAIN) {
+		ERROR("Start failed with %d\n", error);
+		test_failed();
+	}
+
+	// The threads that started are gone
+	uint32_t before = produced;
+	struct timespec t = { 0, 20000000 };
+	nanosleep(&t, NULL);
+	if (produced != before || pipeline.segment_count) {
+		ERROR("Still running: produced %u -> %u\n", before, produced);
+		test_failed();
+	}
+	printf("Done (%u items, %u consumed).\n", produced, atomic_load(&counted));
+}
+
+int main() {
+	srand(time(NULL));
+
+	test_fan_out();
+	test_stop();
+	test_start_failure();
+	return 0;
+}
@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L
+#include "pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS        8
+#define BUFFERS        500
+#define ROUNDS         20
+
+#define ERROR(...) do { printf(__VA_ARGS__); printf("Line: %d\n", __LINE__); } while (0);
+
+pthread_t threads[THREADS];
+pthread_attr_t attr;
+pthread_barrier_t barrier;
+uint32_t id[THREADS];
+pool_t pool;
+// Buffers allocated by each thread, freed by the next one
+uint8_t * buffers[THREADS][BUFFERS];
+size_t sizes[THREADS][BUFFERS];
+
+static void test_failed(void) {
+	exit(1);
+}
+
+static void check(uint8_t * p, size_t size, uint8_t value) {
+	for (size_t i=0; i<size; i++) {
+		if (p[i] != value) {
+			ERROR("Buffer %p (%zu bytes) overwritten at %zu\n", (void *)p, size, i);
+			test_failed();
+		}
+	}
+}
+
+void * worker(void * p) {
+	uint32_t id = *(uint32_t *) p;
+	unsigned int seed = id;
+
+	for (int r=0; r<ROUNDS; r++) {
+		for (int i=0; i<BUFFERS; i++) {
+			// Mostly small, some larger than POOL_MAX_SIZE
+			size_t size = rand_r(&seed) % 10 ? 1 + rand_r(&seed) % 300
+			                                  : POOL_MAX_SIZE + rand_r(&seed) % 100;
+			buffers[id][i] = (uint8_t *)pool_alloc(&pool, size);
+			sizes[id][i] = size;
+			memset(buffers[id][i], id + r, size);
+		}
+		pthread_barrier_wait(&barrier);
+
+		uint32_t other = (id + 1) % THREADS;
+		for (int i=0; i<BUFFERS; i++) {
+			check(buffers[other][i], sizes[other][i], other + r);
+			pool_free(buffers[other][i]);
+		}
+		pthread_barrier_wait(&barrier);
+	}
+	return NULL;
+}
+
+void test_single_threaded(void) {
+	printf("Test single threaded\n");
+	pool_init(&pool);
+
+	void * a = pool_alloc(&pool, 10);
+	void * b = pool_alloc(&pool, 10);
+	if (a == b) test_failed();
+	if ((uintptr_t)a % _Alignof(max_align_t)) test_failed();
+	pool_free(a);
+	// The thread cache hands back the most recently freed buffer
+	if (pool_alloc(&pool, 16) != a) test_failed();
+	pool_free(b);
+	pool_free(NULL);
+
+	// Not freed, released by pool_destroy
+	for (int i=0; i<1000; i++)
+		memset(pool_alloc(&pool, 1 + i % POOL_MAX_SIZE), 0, 1 + i % POOL_MAX_SIZE);
+
+	pool_destroy(&pool);
+	printf("Done.\n");
+}
+
+void test_multiple(void) {
+	printf("Test %u threads\n", THREADS);
+	pool_init(&pool);
+	pthread_barrier_init(&barrier, NULL, THREADS);
+
+	for (int i=0; i<THREADS; i++)
+		pthread_create(&threads[i], &attr, worker, &id[i]);
+
+	for (int i=0; i<THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_barrier_destroy(&barrier);
+	pool_destroy(&pool);
+	printf("Done.\n");
+}
+
+int main() {
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+	for (int i=0; i<THREADS; i++)
+		id[i] = i;
+
+	test_single_threaded();
+	test_multiple();
+
+	pthread_attr_destroy(&attr);
+	pthread_exit(NULL);
+	return 0;
+}
@@ -10,6 +10,12 @@ pthread_attr_t attr;
 int id[] = {0, 1, 2, 3};
 semaphore_t sem;
 
+#define ERROR(...) do { printf(__VA_ARGS__); printf("Line: %d\n", __LINE__); } while (0);
+
+static void test_failed(void) {
+	exit(1);
+}
+
 void delay(void) {
 	struct timespec t;
 	t.tv_sec = 0;
@@ -78,6 +84,56 @@ int main() {
 	for (int i=0; i<4; i++)
 		pthread_join(threads[i], NULL);
 
+	uint32_t c = UINT32_MAX;
+	struct timespec t, now;
+	sem_set(&sem, 1);
+	bool ok = sem_trywait(&sem, &c);
+	printf("Main: sem = 1, trywait: %d (c = %u)\n", ok, c);
+	if (!ok || c != 0) {
+		ERROR("trywait on 1 failed or left %u\n", c);
+		test_failed();
+	}
+	ok = sem_trywait(&sem, &c);
+	printf("Main: sem = 0, trywait: %d\n", ok);
+	if (ok) {
+		ERROR("trywait on 0 decremented\n");
+		test_failed();
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	t.tv_sec++;
+	ok = sem_timedwait(&sem, &t, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	printf("Main: timedwait 1s: %d\n", ok);
+	// Times out, and not before the deadline
+	if (ok || now.tv_sec < t.tv_sec || (now.tv_sec == t.tv_sec && now.tv_nsec < t.tv_nsec)) {
+		ERROR("timedwait on 0 returned %d early or without timing out\n", ok);
+		test_failed();
+	}
+
+	// inc 0 signals 6 times
+	pthread_create(&threads[0], &attr, inc, &id[0]);
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	t.tv_sec += 2;
+	ok = sem_timedwait(&sem, &t, &c);
+	printf("Main: timedwait with inc running: %d (c = %u)\n", ok, c);
+	if (!ok || c >= 6) {
+		ERROR("timedwait with inc running returned %d, c = %u\n", ok, c);
+		test_failed();
+	}
+	pthread_join(threads[0], NULL);
+	// 6 signals, 1 wait
+	for (int i=0; i<5; i++) {
+		if (!sem_trywait(&sem, NULL)) {
+			ERROR("Only %d left after inc\n", i);
+			test_failed();
+		}
+	}
+	if (sem_trywait(&sem, NULL)) {
+		ERROR("More than 5 left after inc\n");
+		test_failed();
+	}
+
 	sem_destroy(&sem);
 	pthread_attr_destroy(&attr);
 	pthread_exit(NULL);
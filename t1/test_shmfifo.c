@@ -0,0 +1,164 @@
+#define _POSIX_C_SOURCE 200809L
+#include "shmfifo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define FIFO_LEN       10
+#define ITERATIONS     500
+#define PRODUCERS      4
+#define CONSUMERS      3
+
+#define ERROR(...) do { printf(__VA_ARGS__); printf("Line: %d\n", __LINE__); } while (0);
+
+typedef struct {
+	uint32_t producer;
+	uint32_t value;
+	char text[20];
+} message_t;
+
+char name[64];
+
+static void test_failed(void) {
+	shmfifo_unlink(name);
+	exit(1);
+}
+
+void delay(void) {
+	struct timespec t;
+	t.tv_sec = 0;
+	t.tv_nsec = (rand() % 100) * 1000;
+	nanosleep(&t, NULL);
+}
+
+// Producer process: writes values from 0 to ITERATIONS-1
+void producer(uint32_t id) {
+	shmfifo_t shmfifo;
+	if (shmfifo_attach(&shmfifo, name) < 0) {
+		ERROR("Producer %u: attach failed: %s\n", id, strerror(errno));
+		exit(1);
+	}
+
+	for (uint32_t i=0; i<ITERATIONS; i++) {
+		delay();
+		uint64_t seq;
+		message_t * m = (message_t *)shmfifo_claim(&shmfifo, &seq);
+		m->producer = id;
+		m->value = i;
+		snprintf(m->text, sizeof(m->text), "%u:%u", id, i);
+		shmfifo_publish(&shmfifo, seq);
+	}
+
+	shmfifo_close(&shmfifo);
+	exit(0);
+}
+
+// Consumer process: reads everything, in order for each producer
+void consumer(uint32_t id) {
+	shmfifo_t shmfifo;
+	if (shmfifo_attach(&shmfifo, name) < 0) {
+		ERROR("Consumer %u: attach failed: %s\n", id, strerror(errno));
+		exit(1);
+	}
+
+	uint32_t counters[PRODUCERS] = {0};
+	for (uint32_t i=0; i<ITERATIONS * PRODUCERS; i++) {
+		delay();
+		const message_t * m = (const message_t *)shmfifo_read(&shmfifo, id);
+		char text[20];
+		snprintf(text, sizeof(text), "%u:%u", m->producer, m->value);
+		if (m->producer >= PRODUCERS || m->value != counters[m->producer]++
+		    || strcmp(text, m->text)) {
+			ERROR("Consumer %u: expected %u, got %s\n", id,
+			      counters[m->producer] - 1, m->text);
+			exit(1);
+		}
+		shmfifo_release(&shmfifo, id);
+	}
+
+	shmfifo_close(&shmfifo);
+	exit(0);
+}
+
+void test_single_process(void) {
+	printf("Test single process\n");
+	shmfifo_t a, b;
+	if (shmfifo_attach(&a, name) == 0) test_failed();
+	if (shmfifo_create(&a, name, 4, 2, sizeof(message_t)) < 0) test_failed();
+	if (shmfifo_create(&b, name, 4, 2, sizeof(message_t)) == 0 || errno != EEXIST)
+		test_failed();
+	// Mapped at another address, like in another process
+	if (shmfifo_attach(&b, name) < 0) test_failed();
+	if (a.header == b.header) test_failed();
+
+	uint64_t seq;
+	for (uint32_t i=0; i<4; i++) {
+		message_t * m = (message_t *)shmfifo_claim(&a, &seq);
+		if (seq != i) test_failed();
+		m->value = i;
+		shmfifo_publish(&a, seq);
+	}
+
+	for (uint32_t i=0; i<4; i++) {
+		for (uint32_t k=0; k<2; k++) {
+			const message_t * m = (const message_t *)shmfifo_try_read(&b, k);
+			if (!m || m->value != i) test_failed();
+			shmfifo_release(&b, k);
+		}
+	}
+	if (shmfifo_try_read(&b, 0)) test_failed();
+
+	shmfifo_close(&b);
+	shmfifo_close(&a);
+	if (shmfifo_unlink(name) < 0) test_failed();
+	printf("Done.\n");
+}
+
+void test_processes(void) {
+	printf("Test %u producer, %u consumer processes\n", PRODUCERS, CONSUMERS);
+	shmfifo_t shmfifo;
+	if (shmfifo_create(&shmfifo, name, FIFO_LEN, CONSUMERS, sizeof(message_t)) < 0)
+		test_failed();
+
+	// Children must not print the parent's buffered output again
+	fflush(stdout);
+	pid_t pids[PRODUCERS + CONSUMERS];
+	for (uint32_t i=0; i<PRODUCERS + CONSUMERS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			test_failed();
+		if (pids[i] == 0) {
+			srand(getpid());
+			if (i < CONSUMERS)
+				consumer(i);
+			else
+				producer(i - CONSUMERS);
+		}
+	}
+
+	for (uint32_t i=0; i<PRODUCERS + CONSUMERS; i++) {
+		int status;
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status)
+		    || WEXITSTATUS(status)) {
+			ERROR("Process %u failed\n", i);
+			test_failed();
+		}
+	}
+
+	shmfifo_close(&shmfifo);
+	shmfifo_unlink(name);
+	printf("Done.\n");
+}
+
+int main() {
+	srand(time(NULL));
+	snprintf(name, sizeof(name), "/test_shmfifo_%d", (int)getpid());
+
+	test_single_process();
+	test_processes();
+	return 0;
+}